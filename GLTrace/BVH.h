@@ -3,8 +3,16 @@
 #include <vector>
 #include "Hittables.h"
 #include "ComputeShader.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
 #include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <thread>
 struct aabb {
 	glm::vec4 aabbMin = glm::vec4(glm::vec3(1e30f), 1.0f), aabbMax = glm::vec4(glm::vec3(-1e30f), 1.0f); // vec4 for 16 byte padding
 	void grow(const glm::vec3& p) {
@@ -25,293 +33,1657 @@ struct aabb {
 
 struct Bin {
 	aabb bounds;
-	int quadCount = 0;
-	int sphereCount = 0;
+	int count = 0;
+};
+
+enum BVHPrimitiveType {
+	BVH_PRIMITIVE_QUAD,
+	BVH_PRIMITIVE_SPHERE,
+	BVH_PRIMITIVE_TYPE_COUNT,
+};
+static const unsigned int BVH_UNREFERENCED_PRIMITIVE = 0xFFFFFFFFu; // Index map entry for a primitive no leaf references
+
+// Entry in the BVH's primitive reference list, the primitive type is stored in the top bits above its index
+// Sorting references by value groups them by type, which is how leaves are ordered
+struct BVHPrimitiveRef {
+	static const unsigned int TYPE_SHIFT = 28;
+	static const unsigned int INDEX_MASK = (1u << TYPE_SHIFT) - 1u;
+
+	static unsigned int Make(const BVHPrimitiveType type, const unsigned int index) { return ((unsigned int)type << TYPE_SHIFT) | index; }
+	static BVHPrimitiveType Type(const unsigned int reference) { return (BVHPrimitiveType)(reference >> TYPE_SHIFT); }
+	static unsigned int Index(const unsigned int reference) { return reference & INDEX_MASK; }
 };
 
 struct BVHNode {
 	aabb bbox;
 	unsigned int leftChild; // rightChild == leftChild + 1
-	unsigned int firstQuadPrimitive, quadPrimitiveCount;
-	unsigned int firstSpherePrimitive, spherePrimitiveCount;
-	unsigned int padding1, padding2, padding3;
-	bool isLeaf() { return (quadPrimitiveCount > 0 || spherePrimitiveCount > 0); }
+	unsigned int firstPrimitive, primitiveCount; // Range of the primitive reference list
+	unsigned int padding;
+	bool isLeaf() const { return primitiveCount > 0; }
+};
+
+// 4 wide node for GPU traversal, child bounds are stored per axis so the shader can slab test all four children at once
+// Internal lanes hold a wide node index with a zero count, leaf lanes hold the leaf's first primitive reference and count
+struct BVHWideNode {
+	static const unsigned int WIDTH = 4;
+	static const unsigned int INVALID_CHILD = 0xFFFFFFFFu;
+
+	glm::vec4 childMinX, childMinY, childMinZ;
+	glm::vec4 childMaxX, childMaxY, childMaxZ;
+	glm::uvec4 child;
+	glm::uvec4 counts;
+};
+
+// Wide node with child bounds quantised to 8 bits per plane relative to the union of its children, 80 bytes instead of 128
+// Each axis uses a power of two scale so decoding is exact, and bounds are rounded outwards so they always contain the child
+struct BVHCompressedNode {
+	glm::vec3 origin;
+	unsigned int exponents;		// Biased 8 bit scale exponent per axis
+	glm::uvec4 child;
+	glm::uvec4 counts;
+	glm::uvec3 quantisedMin;	// One byte per lane
+	unsigned int padding1;
+	glm::uvec3 quantisedMax;
+	unsigned int padding2;
+
+	// Returns false if a child's bounds can't be represented even at the largest scale, the node must then stay uncompressed
+	static bool Encode(const BVHWideNode& node, BVHCompressedNode& compressed) {
+		compressed.exponents = 0;
+		compressed.child = node.child;
+		compressed.counts = node.counts;
+		compressed.quantisedMin = glm::uvec3(0u);
+		compressed.quantisedMax = glm::uvec3(0u);
+		compressed.padding1 = 0;
+		compressed.padding2 = 0;
+
+		const glm::vec4* childMin[3] = { &node.childMinX, &node.childMinY, &node.childMinZ };
+		const glm::vec4* childMax[3] = { &node.childMaxX, &node.childMaxY, &node.childMaxZ };
+		for (int a = 0; a < 3; a++) {
+			float lo = 1e30f, hi = -1e30f;
+			for (unsigned int i = 0; i < BVHWideNode::WIDTH; i++) {
+				if (node.child[i] == BVHWideNode::INVALID_CHILD) { continue; }
+				lo = std::min(lo, (*childMin[a])[i]);
+				hi = std::max(hi, (*childMax[a])[i]);
+			}
+			if (lo > hi) { lo = hi = 0.0f; }
+			if (!std::isfinite(lo) || !std::isfinite(hi)) { return false; }
+			compressed.origin[a] = lo;
+
+			// Smallest scale that fits the extent in 255 steps, grown if rounding pushes a child out of range
+			int exponent = (hi > lo) ? (int)std::ceil(std::log2(((double)hi - lo) / 255.0)) : MIN_EXPONENT;
+			exponent = std::max(MIN_EXPONENT, std::min(MAX_EXPONENT, exponent));
+			unsigned int packedMin = 0, packedMax = 0;
+			while (!QuantiseAxis(node, *childMin[a], *childMax[a], lo, exponent, packedMin, packedMax)) {
+				if (exponent == MAX_EXPONENT) { return false; }
+				exponent++;
+			}
+			compressed.exponents |= (unsigned int)(exponent + 127) << (a * 8);
+			compressed.quantisedMin[a] = packedMin;
+			compressed.quantisedMax[a] = packedMax;
+		}
+		return true;
+	}
+
+	aabb DecodeChildBounds(const unsigned int lane) const {
+		aabb bounds;
+		for (int a = 0; a < 3; a++) {
+			const float scale = std::ldexp(1.0f, (int)((exponents >> (a * 8)) & 0xFFu) - 127);
+			bounds.aabbMin[a] = origin[a] + (float)((quantisedMin[a] >> (lane * 8)) & 0xFFu) * scale;
+			bounds.aabbMax[a] = origin[a] + (float)((quantisedMax[a] >> (lane * 8)) & 0xFFu) * scale;
+		}
+		return bounds;
+	}
+
+private:
+	static const int MIN_EXPONENT = -126;
+	static const int MAX_EXPONENT = 127;
+
+	// Rounds each child's bounds outwards onto the grid, returns false if a child doesn't fit in 8 bits
+	static bool QuantiseAxis(const BVHWideNode& node, const glm::vec4& childMin, const glm::vec4& childMax, const float origin, const int exponent, unsigned int& packedMin, unsigned int& packedMax) {
+		const float scale = std::ldexp(1.0f, exponent);
+		packedMin = 0;
+		packedMax = 0;
+		for (unsigned int i = 0; i < BVHWideNode::WIDTH; i++) {
+			if (node.child[i] == BVHWideNode::INVALID_CHILD) { continue; }
+			// In double so extents near the float range can't overflow before the range check
+			const double highSteps = std::ceil(((double)childMax[i] - origin) / scale);
+			if (highSteps > 255.0) { return false; }
+			int low = std::max(0, (int)std::floor(((double)childMin[i] - origin) / scale));
+			int high = std::max(0, (int)highSteps);
+			while (low > 0 && origin + (float)low * scale > childMin[i]) { low--; }
+			while (high <= 255 && origin + (float)high * scale < childMax[i]) { high++; }
+			if (high > 255) { return false; }
+			packedMin |= (unsigned int)low << (i * 8);
+			packedMax |= (unsigned int)std::max(high, 0) << (i * 8);
+		}
+		return true;
+	}
+};
+
+enum BVHBuildMethod {
+	BVH_BUILD_SAH,	// Binned SAH, best trace performance
+	BVH_BUILD_LBVH,	// Morton code linear BVH, fastest build for geometry that changes every frame
+	BVH_BUILD_SBVH,	// Binned SAH with spatial splits, slowest build but fewer overlapping nodes for static scenes
+	BVH_BUILD_PLOC,	// Bottom up clustering of Morton sorted primitives, close to SAH quality at close to LBVH build speed
+	BVH_BUILD_METHOD_COUNT
+};
+
+enum BVHBuildQuality {
+	BVH_QUALITY_FAST,
+	BVH_QUALITY_BALANCED,
+	BVH_QUALITY_HIGH,
+	BVH_QUALITY_COUNT
+};
+
+struct BVHBuildSettings {
+	static const unsigned int MAX_BINS = 64;
+
+	unsigned int binCount = 16;			// SAH bins per axis, up to MAX_BINS
+	float traversalCost = 1.0f;			// Cost of visiting a node relative to intersecting one primitive
+	unsigned int maxLeafSize = 4;		// Nodes with more primitives are split even if SAH prefers a leaf
+	bool exactSweep = false;			// Evaluate every primitive boundary instead of binning, slow but best quality
+	bool wideBVH = true;				// Collapse the binary tree into a 4 wide BVH for GPU traversal after each build or refit
+	bool compressWideBVH = false;		// Upload the wide BVH with quantised child bounds, less memory and bandwidth for slightly looser bounds
+	bool reorderPrimitives = true;		// Upload quads and spheres in leaf order so each leaf's primitives are contiguous in memory
+	unsigned int optimisationPasses = 0;	// Treelet restructuring passes after each full build, a one off cost worth paying for static scenes
+
+	static BVHBuildSettings FromQuality(const BVHBuildQuality quality) {
+		BVHBuildSettings settings;
+		switch (quality) {
+		case BVH_QUALITY_FAST:
+			settings.binCount = 8;
+			settings.maxLeafSize = 8;
+			break;
+		case BVH_QUALITY_BALANCED:
+		default:
+			break;
+		case BVH_QUALITY_HIGH:
+			settings.exactSweep = true;
+			break;
+		}
+		return settings;
+	}
+};
+
+// Result of the most recent treelet optimisation, SAH costs are relative to the root area as in CalculateSAHCost
+struct BVHOptimisationStats {
+	unsigned int passes = 0;
+	float sahBefore = 0.0f;
+	float sahAfter = 0.0f;
+	float milliseconds = 0.0f;
+};
+
+// Tree quality report from BVH::GatherStats
+struct BVHStats {
+	static const unsigned int LEAF_HISTOGRAM_SIZE = 16; // Leaf sizes 1 to 15, the last bucket holds 16 and above
+
+	float buildMilliseconds = 0.0f;	// Last full build, or the cache load when loadedFromCache
+	bool loadedFromCache = false;
+	unsigned int nodeCount = 0;			// Reachable nodes, including empty nodes left by edits
+	unsigned int leafCount = 0;
+	unsigned int referenceCount = 0;	// Above the primitive count when spatial splits duplicate references
+	unsigned int maxDepth = 0;
+	float averageLeafDepth = 0.0f;
+	unsigned int largestLeaf = 0;
+	unsigned int leafSizeHistogram[LEAF_HISTOGRAM_SIZE] = {};
+	float sahCost = 0.0f;
+	float worstLeafCost = 0.0f;	// Largest single leaf's share of the SAH cost, high when a few huge primitives dominate
+	float overlapCost = 0.0f;	// Sibling overlap areas summed over interior nodes, relative to the root area
+	float maxOverlap = 0.0f;	// Largest sibling overlap as a fraction of its parent's area
+};
+
+// Result of BVH::Validate
+struct BVHValidation {
+	bool valid = true;
+	unsigned int unreachablePrimitives = 0;
+	unsigned int uncontainedChildren = 0;	// Child bounds that are not inside their parent's bounds
+	unsigned int invalidNodes = 0;			// Child indices or leaf ranges outside the tree or the reference list
+};
+
+// World space bounds and centres of every primitive in a BVH, gathered once per build so the builder never transforms a primitive itself
+// Stored as a structure of arrays in BVH reference order so each node's primitives are contiguous
+// Copies of the primitives and transforms the cache was last calculated from, so refits only recalculate primitives that changed
+struct BVHPrimitiveSources {
+	// Flags every transform, quad and sphere that differs from its copy and takes new copies, returns true if any did
+	bool FindChanges(const std::vector<Quad>& newQuads, const std::vector<Sphere>& newSpheres, const std::vector<glm::mat4>& transformBuffer) {
+		bool changed = false;
+		const unsigned int num_transforms = transformBuffer.size();
+		transforms.resize(num_transforms, glm::mat4(0.0f));
+		transformsChanged.assign(num_transforms, false);
+		for (unsigned int i = 0; i < num_transforms; i++) {
+			if (transforms[i] != transformBuffer[i]) {
+				transforms[i] = transformBuffer[i];
+				transformsChanged[i] = true;
+				changed = true;
+			}
+		}
+		changed = FindChanges(newQuads, quads, quadsChanged) || changed;
+		changed = FindChanges(newSpheres, spheres, spheresChanged) || changed;
+		return changed;
+	}
+
+	// Expects FindChanges to have run for the same primitives
+	bool Changed(const unsigned int primitiveRef) const {
+		const unsigned int index = BVHPrimitiveRef::Index(primitiveRef);
+		if (BVHPrimitiveRef::Type(primitiveRef) == BVH_PRIMITIVE_QUAD) {
+			return quadsChanged[index] || transformsChanged[(unsigned int)quads[index].Normal.a];
+		}
+		return spheresChanged[index] || transformsChanged[spheres[index].GetTransformID()];
+	}
+
+	void Clear() {
+		transforms.clear();
+		quads.clear();
+		spheres.clear();
+	}
+
+	// Primitives have no default constructor, new entries are appended as changed
+	template <typename T>
+	static bool FindChanges(const std::vector<T>& primitives, std::vector<T>& sources, std::vector<bool>& primitivesChanged) {
+		bool changed = sources.size() != primitives.size();
+		if (sources.size() > primitives.size()) { sources.erase(sources.begin() + primitives.size(), sources.end()); }
+		primitivesChanged.assign(primitives.size(), true);
+		for (unsigned int i = 0; i < sources.size(); i++) {
+			if (std::memcmp(&sources[i], &primitives[i], sizeof(T)) != 0) {
+				sources[i] = primitives[i];
+				changed = true;
+			}
+			else {
+				primitivesChanged[i] = false;
+			}
+		}
+		sources.insert(sources.end(), primitives.begin() + sources.size(), primitives.end());
+		return changed;
+	}
+
+	std::vector<glm::mat4> transforms;
+	std::vector<Quad> quads;
+	std::vector<Sphere> spheres;
+	std::vector<bool> transformsChanged, quadsChanged, spheresChanged;
+};
+
+struct BVHPrimitiveCache {
+	void Build(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer, const std::vector<unsigned int>& primitiveRefs) {
+		Resize(primitiveRefs.size());
+		Update(quads, spheres, transformBuffer, primitiveRefs, nullptr);
+	}
+
+	// Recalculates the entries for the same references, only those whose primitive or transform changed when sources is given
+	// Returns true if any primitive's bounds moved
+	bool Update(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer, const std::vector<unsigned int>& primitiveRefs, BVHPrimitiveSources* sources) {
+		if (sources && !sources->FindChanges(quads, spheres, transformBuffer)) { return false; }
+
+		const unsigned int count = primitiveRefs.size();
+		std::atomic<bool> changed(false);
+		ThreadPool::ParallelForRange(count, CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			bool chunkChanged = false;
+			for (unsigned int i = begin; i < end; i++) {
+				if (sources && !sources->Changed(primitiveRefs[i])) { continue; }
+				aabb bounds;
+				glm::vec4 worldCentre;
+				GetPrimitiveBounds(quads, spheres, transformBuffer, primitiveRefs[i], bounds, worldCentre);
+				for (int a = 0; a < 3; a++) {
+					chunkChanged = chunkChanged || boundsMin[a][i] != bounds.aabbMin[a] || boundsMax[a][i] != bounds.aabbMax[a];
+					boundsMin[a][i] = bounds.aabbMin[a];
+					boundsMax[a][i] = bounds.aabbMax[a];
+					centre[a][i] = worldCentre[a];
+				}
+			}
+			if (chunkChanged) { changed = true; }
+		});
+		return changed;
+	}
+
+	// Appends an entry for a newly referenced primitive
+	void Push(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer, const unsigned int primitiveRef) {
+		aabb bounds;
+		glm::vec4 worldCentre;
+		GetPrimitiveBounds(quads, spheres, transformBuffer, primitiveRef, bounds, worldCentre);
+		for (int a = 0; a < 3; a++) {
+			boundsMin[a].push_back(bounds.aabbMin[a]);
+			boundsMax[a].push_back(bounds.aabbMax[a]);
+			centre[a].push_back(worldCentre[a]);
+		}
+	}
+
+	void Erase(const unsigned int i) {
+		for (int a = 0; a < 3; a++) {
+			boundsMin[a].erase(boundsMin[a].begin() + i);
+			boundsMax[a].erase(boundsMax[a].begin() + i);
+			centre[a].erase(centre[a].begin() + i);
+		}
+	}
+
+	void Resize(const unsigned int count) {
+		for (int a = 0; a < 3; a++) {
+			boundsMin[a].resize(count);
+			boundsMax[a].resize(count);
+			centre[a].resize(count);
+		}
+	}
+
+	void Copy(const BVHPrimitiveCache& source, const unsigned int from, const unsigned int to) {
+		for (int a = 0; a < 3; a++) {
+			boundsMin[a][to] = source.boundsMin[a][from];
+			boundsMax[a][to] = source.boundsMax[a][from];
+			centre[a][to] = source.centre[a][from];
+		}
+	}
+
+	void Swap(const unsigned int i, const unsigned int j) {
+		for (int a = 0; a < 3; a++) {
+			std::swap(boundsMin[a][i], boundsMin[a][j]);
+			std::swap(boundsMax[a][i], boundsMax[a][j]);
+			std::swap(centre[a][i], centre[a][j]);
+		}
+	}
+
+	static void GetPrimitiveBounds(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer, const unsigned int primitiveRef, aabb& bounds, glm::vec4& worldCentre) {
+		const unsigned int index = BVHPrimitiveRef::Index(primitiveRef);
+		if (BVHPrimitiveRef::Type(primitiveRef) == BVH_PRIMITIVE_QUAD) {
+			const Quad& quad = quads[index];
+			const glm::mat4& transform = transformBuffer[quad.Normal.a];
+			bounds = GetQuadBounds(quad, transform);
+			worldCentre = transform * quad.GetCentre();
+		}
+		else {
+			const Sphere& sphere = spheres[index];
+			const glm::mat4& transform = transformBuffer[sphere.GetTransformID()];
+			bounds = GetSphereBounds(sphere, transform);
+			worldCentre = transform * sphere.Center;
+		}
+	}
+
+	static aabb GetQuadBounds(const Quad& quad, const glm::mat4& transform) {
+		aabb bounds;
+		const glm::vec4& rawQ = quad.GetQ(), rawU = quad.GetU(), rawV = quad.GetV();
+
+		// Get world space vertices
+		glm::vec4 worldQ = rawQ;
+		glm::vec4 worldU = glm::vec4(glm::vec3(worldQ + rawU), 1.0f);
+		glm::vec4 worldV = glm::vec4(glm::vec3(worldQ + rawV), 1.0f);
+
+		// Transform vertices
+		glm::vec4 transformedWorldQ = transform * worldQ;
+		glm::vec4 transformedWorldU = transform * worldU;
+		glm::vec4 transformedWorldV = transform * worldV;
+
+		const glm::vec4 Q = transformedWorldQ;
+		const glm::vec4 U = transformedWorldU - transformedWorldQ;
+		const glm::vec4 V = transformedWorldV - transformedWorldQ;
+
+		const glm::vec4 QU = Q + U;
+		const glm::vec4 QV = Q + V;
+		const glm::vec4 QUV = Q + U + V;
+
+		bounds.grow(Q);
+		bounds.grow(QU);
+		bounds.grow(QV);
+
+		if (quad.triangle_disk_id != 1u) { // if not a triangleh
+			bounds.grow(QUV);
+		}
+
+		if (quad.triangle_disk_id == 2u) {
+			bounds.grow(Q - U);
+			bounds.grow(Q - V);
+			bounds.grow(Q - (U + V));
+			bounds.grow(Q - (U - V));
+		}
+		return bounds;
+	}
+
+	// World space corners of a quad in winding order, triangles repeat their last vertex and disks use their bounding parallelogram
+	static void GetQuadOutline(const Quad& quad, const glm::mat4& transform, glm::vec3* vertices) {
+		const glm::vec3 Q = transform * quad.GetQ();
+		const glm::vec3 U = glm::vec3(transform * glm::vec4(glm::vec3(quad.GetQ() + quad.GetU()), 1.0f)) - Q;
+		const glm::vec3 V = glm::vec3(transform * glm::vec4(glm::vec3(quad.GetQ() + quad.GetV()), 1.0f)) - Q;
+
+		if (quad.triangle_disk_id == 2u) {
+			vertices[0] = Q - U - V;
+			vertices[1] = Q + U - V;
+			vertices[2] = Q + U + V;
+			vertices[3] = Q - U + V;
+		}
+		else {
+			vertices[0] = Q;
+			vertices[1] = Q + U;
+			vertices[2] = quad.triangle_disk_id == 1u ? Q + V : Q + U + V;
+			vertices[3] = Q + V;
+		}
+	}
+
+	static aabb GetSphereBounds(const Sphere& sphere, const glm::mat4& transform) {
+		aabb bounds;
+		const glm::vec4& center = transform * sphere.Center;
+		const float sphereRadius = sphere.Radius;
+
+		const glm::vec3 sphereMin = glm::vec3(center) - glm::vec3(sphereRadius), sphereMax = glm::vec3(center) + glm::vec3(sphereRadius);
+
+		bounds.grow(glm::vec4(sphereMin, 1.0f));
+		bounds.grow(glm::vec4(sphereMax, 1.0f));
+		return bounds;
+	}
+
+	static const unsigned int CHUNK_SIZE = 4096;
+
+	std::vector<float> boundsMin[3], boundsMax[3], centre[3];
 };
 
 class BVH {
 public:
-	BVH() {}
+	BVH() : rootNodeID(0), nodesUsed(0), totalElements(0), buildMethod(BVH_BUILD_SAH), buildSettings(BVHBuildSettings::FromQuality(BVH_QUALITY_BALANCED)), buildQuality(BVH_QUALITY_BALANCED), builtQuadCount(0), builtSphereCount(0), builtSAHCost(0.0f), buildMilliseconds(0.0f), loadedFromCache(false), rebuildThreshold(0.25f), maxRebuildLatency(8), rebuildGeneration(0), statsCurrent(false), validationCurrent(false), editsPending(false), depthFirstOrder(true), parentsValid(false), taskCount(0), spatialSplitBudget(0.3f), spatialSplitsLeft(0), sbvhRootArea(0.0f) {}
 	~BVH() {}
 
+	// Rebuilds if the primitive count changed without going through InsertPrimitive / RemovePrimitive, otherwise refits once primitives have moved
+	// and only rebuilds after refitting or incremental edits have degraded the tree's SAH cost past the rebuild threshold
+	// That rebuild runs in the background unless maxRebuildLatency is 0, the refitted tree is used until it completes
+	// Returns false if nothing changed since the last update
+	bool UpdateBVH(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
+		if (quads.size() != builtQuadCount || spheres.size() != builtSphereCount) {
+			BuildBVH(quads, spheres, transformBuffer);
+			return true;
+		}
+
+		const bool swapped = UpdateRebuild();
+		const bool moved = primitiveCache.Update(quads, spheres, transformBuffer, primitiveRefs, &primitiveSources);
+		if (!moved && !editsPending && !swapped) { return false; }
+		editsPending = false;
+		if (moved) { RefitNodes(); }
+		if (!IsRebuilding() && CalculateSAHCost() > builtSAHCost * (1.0f + rebuildThreshold)) {
+			if (maxRebuildLatency == 0) {
+				BuildBVH(quads, spheres, transformBuffer);
+				return true;
+			}
+			StartRebuild(quads, spheres, transformBuffer);
+		}
+		CollapseWide();
+		return true;
+	}
+
 	void RefitBVH(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
-		for (int i = nodesUsed - 1; i >= 0; i--) {
-			if (i != 1) {
-				BVHNode& node = tree[i];
-				if (node.isLeaf()) {
-					UpdateNodeBounds(i, quads, spheres, transformBuffer);
-					continue;
-				}
-				// not leaf node, adjust to child node bounds
-				BVHNode& leftChild = tree[node.leftChild];
-				BVHNode& rightChild = tree[node.leftChild + 1];
-				node.bbox.aabbMin = glm::min(leftChild.bbox.aabbMin, rightChild.bbox.aabbMin);
-				node.bbox.aabbMax = glm::max(leftChild.bbox.aabbMax, rightChild.bbox.aabbMax);
+		primitiveCache.Update(quads, spheres, transformBuffer, primitiveRefs, &primitiveSources);
+		RefitNodes();
+		CollapseWide();
+	}
+
+	// Adds the primitive at index, which must have just been appended to its list. Until the BVH has been built this does nothing and UpdateBVH builds it in full
+	// Leaves the wide tree empty until the next UpdateBVH, so edits can be batched
+	void InsertPrimitive(const BVHPrimitiveType type, const unsigned int index, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
+		if (tree.empty() || totalElements == 0) { return; }
+		if (quads.size() != builtQuadCount + (type == BVH_PRIMITIVE_QUAD) || spheres.size() != builtSphereCount + (type == BVH_PRIMITIVE_SPHERE)) { return; }
+		BuildParents();
+
+		const unsigned int primitiveRef = BVHPrimitiveRef::Make(type, index);
+		primitiveRefs.push_back(primitiveRef);
+		primitiveCache.Push(quads, spheres, transformBuffer, primitiveRef);
+
+		BVHNode leaf;
+		leaf.leftChild = 0;
+		leaf.firstPrimitive = primitiveRefs.size() - 1;
+		leaf.primitiveCount = 1;
+		leaf.padding = 0;
+		UpdateNodeBounds(leaf);
+
+		// The sibling's slot becomes the new parent, the sibling and the new leaf move into a fresh child pair
+		const unsigned int siblingID = FindBestSibling(leaf.bbox);
+		const unsigned int pair = AllocatePair();
+		tree[pair] = tree[siblingID];
+		tree[pair + 1] = leaf;
+		parents[pair] = siblingID;
+		parents[pair + 1] = siblingID;
+		if (!tree[pair].isLeaf()) {
+			parents[tree[pair].leftChild] = pair;
+			parents[tree[pair].leftChild + 1] = pair;
+		}
+
+		BVHNode& parent = tree[siblingID];
+		parent.leftChild = pair;
+		parent.firstPrimitive = 0;
+		parent.primitiveCount = 0;
+		RefitAncestors(siblingID);
+
+		if (type == BVH_PRIMITIVE_QUAD) { builtQuadCount++; }
+		else { builtSphereCount++; }
+		totalElements++;
+		MarkEdited();
+	}
+
+	// Removes every reference to the primitive that was at index, which must have just been erased from its list. Later primitives of the same type move down one index
+	void RemovePrimitive(const BVHPrimitiveType type, const unsigned int index, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres) {
+		if (tree.empty() || totalElements == 0) { return; }
+		if (quads.size() + (type == BVH_PRIMITIVE_QUAD) != builtQuadCount || spheres.size() + (type == BVH_PRIMITIVE_SPHERE) != builtSphereCount) { return; }
+		BuildParents();
+
+		// Spatial splits can reference a primitive more than once
+		const unsigned int primitiveRef = BVHPrimitiveRef::Make(type, index);
+		for (int position = primitiveRefs.size() - 1; position >= 0; position--) {
+			if (primitiveRefs[position] == primitiveRef) { RemoveReference(position); }
+		}
+		for (unsigned int& ref : primitiveRefs) {
+			if (BVHPrimitiveRef::Type(ref) == type && BVHPrimitiveRef::Index(ref) > index) {
+				ref = BVHPrimitiveRef::Make(type, BVHPrimitiveRef::Index(ref) - 1);
 			}
 		}
+
+		if (type == BVH_PRIMITIVE_QUAD) { builtQuadCount--; }
+		else { builtSphereCount--; }
+		totalElements--;
+		MarkEdited();
 	}
 
 	void BuildBVH(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
 		auto start = std::chrono::high_resolution_clock::now();
 		totalElements = quads.size() + spheres.size();
 		nodesUsed = 2;
-
+		builtQuadCount = quads.size();
+		builtSphereCount = spheres.size();
+		builtSAHCost = 0.0f;
+		wideTree.clear();
+		freePairs.clear();
+		editsPending = false;
+		depthFirstOrder = true;
+		parentsValid = false;
+		rebuildGeneration++;
+		InvalidateStats();
+
+		primitiveRefs.clear();
+		compressedTree.clear();
+		primitiveCache.Resize(0);
+		primitiveSources.Clear();
 		if (totalElements <= 0) {
 			return;
 		}
 
-		// Initialise hittable IDs
-		quadIDs.clear();
-		sphereIDs.clear();
-		quadIDs.reserve(quads.size());
-		sphereIDs.reserve(spheres.size());
+		// Initialise primitive references
+		primitiveRefs.reserve(totalElements);
 		for (unsigned int i = 0; i < quads.size(); i++) {
-			quadIDs.push_back(i);
+			primitiveRefs.push_back(BVHPrimitiveRef::Make(BVH_PRIMITIVE_QUAD, i));
 		}
 		for (unsigned int i = 0; i < spheres.size(); i++) {
-			sphereIDs.push_back(i);
+			primitiveRefs.push_back(BVHPrimitiveRef::Make(BVH_PRIMITIVE_SPHERE, i));
 		}
+		primitiveCache.Build(quads, spheres, transformBuffer, primitiveRefs);
+		primitiveSources.FindChanges(quads, spheres, transformBuffer);
 
-		// Create root node
-		tree.clear();
-		tree.reserve(totalElements * 2 + 2);
-		for (unsigned int i = 0; i < totalElements * 2 + 2; i++) {
-			tree.push_back(BVHNode());
-		}
+		// Create root node, nodes are reused between builds and children are reset as they are split off
+		tree.resize(totalElements * 2 + 2);
+		tree[1] = BVHNode();
+		tree[2] = BVHNode();
 		BVHNode& root = tree[0];
-		root.leftChild = 0;
-		root.quadPrimitiveCount = quads.size();
-		root.spherePrimitiveCount = spheres.size();
-		root.padding1 = 0;
-		root.padding2 = 0;
-		root.padding3 = 0;
-		UpdateNodeBounds(rootNodeID, quads, spheres, transformBuffer);
-
-		// Recursive build
-		Subdivide(rootNodeID, quads, spheres, transformBuffer);
-		auto end = std::chrono::high_resolution_clock::now();
-		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-
-		// Extract hours, minutes, and seconds from the total duration
-		auto hours = std::chrono::duration_cast<std::chrono::hours>(duration);
-		duration -= hours;
-		auto minutes = std::chrono::duration_cast<std::chrono::minutes>(duration);
-		duration -= minutes;
-		auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
-		duration -= seconds;
-		auto milliseconds = duration;  // Remaining milliseconds
+		root = BVHNode();
+		root.firstPrimitive = 0;
+		root.primitiveCount = totalElements;
 
-		// Display the time elapsed
-		//std::clog << "BVH constructed in: "
-		//	<< hours.count() << " hours, "
-		//	<< minutes.count() << " minutes, "
-		//	<< seconds.count() << " seconds, "
-		//	<< milliseconds.count() << " milliseconds\r\n";
+		if (buildMethod == BVH_BUILD_LBVH) {
+			BuildLBVH();
+		}
+		else if (buildMethod == BVH_BUILD_SBVH) {
+			BuildSBVH(quads, spheres, transformBuffer);
+		}
+		else if (buildMethod == BVH_BUILD_PLOC) {
+			BuildPLOC();
+		}
+		else if (totalElements >= PARALLEL_BUILD_THRESHOLD && ThreadPool::NumThreads() > 1) {
+			// Parallel build
+			UpdateNodeBoundsParallel(root);
+			ParallelSubdivide();
+		}
+		else {
+			// Recursive build
+			UpdateNodeBounds(root);
+			Subdivide(tree, nodesUsed, rootNodeID);
+		}
+		SortLeavesByType();
+		if (buildSettings.optimisationPasses > 0) { OptimiseTreelets(buildSettings.optimisationPasses); }
+		builtSAHCost = CalculateSAHCost();
+		CollapseWide();
+		buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		loadedFromCache = false;
 	}
 
 	void Buffer(ComputeShader& computeShader) const {
 		const ShaderStorageBuffer* bvhSSBO = computeShader.GetSSBO(1);
-		const ShaderStorageBuffer* sphereSSBO = computeShader.GetSSBO(2);
-		const ShaderStorageBuffer* quadSSBO = computeShader.GetSSBO(3);
+		const ShaderStorageBuffer* referenceSSBO = computeShader.GetSSBO(2);
+
+		const ShaderStorageBuffer* wideSSBO = computeShader.GetSSBO(12);
+		const ShaderStorageBuffer* compressedSSBO = computeShader.GetSSBO(13);
+		const unsigned int wideNodesUsed = wideTree.size();
+		const unsigned int wideNodeFormat = (compressedTree.size() > 0) ? 1 : 0;
 
 		// BVH buffer
 		// ----------
+		// The binary tree is only needed by the shader when there is no wide tree
+		const unsigned int binaryNodes = (wideNodesUsed > 0) ? 0 : nodesUsed + 1;
+
 		// Initialise buffer
-		bvhSSBO->BufferData(nullptr, (sizeof(BVHNode) * (nodesUsed + 1)) + (sizeof(unsigned int) * 4), GL_STREAM_COPY);
+		bvhSSBO->BufferData(nullptr, (sizeof(BVHNode) * binaryNodes) + (sizeof(unsigned int) * HEADER_SIZE), GL_STREAM_COPY);
 
 		// Buffer data
-		bvhSSBO->BufferSubData(&totalElements, sizeof(unsigned int), 0);
-		bvhSSBO->BufferSubData(&nodesUsed, sizeof(unsigned int), sizeof(unsigned int));
+		const unsigned int header[HEADER_SIZE] = { totalElements, nodesUsed, wideNodesUsed, wideNodeFormat };
+		bvhSSBO->BufferSubData(&header[0], sizeof(unsigned int) * HEADER_SIZE, 0);
+
+		if (binaryNodes > 0 && totalElements > 0) {
+			bvhSSBO->BufferSubData(&tree[0], sizeof(BVHNode) * binaryNodes, sizeof(unsigned int) * HEADER_SIZE);
+		}
+
+		// Wide BVH buffer
+		// ---------------
+		if (wideNodeFormat == 1) {
+			compressedSSBO->BufferData(&compressedTree[0], sizeof(BVHCompressedNode) * compressedTree.size(), GL_STREAM_COPY);
+		}
+		else if (wideNodesUsed > 0) {
+			wideSSBO->BufferData(&wideTree[0], sizeof(BVHWideNode) * wideNodesUsed, GL_STREAM_COPY);
+		}
+
+		// Primitive reference buffer
+		// --------------------------
+		if (primitiveRefs.size() > 0) {
+			if (buildSettings.reorderPrimitives) {
+				// References point into the leaf ordered primitive buffers, see PermuteToLeafOrder
+				leafOrderRefs.resize(primitiveRefs.size());
+				unsigned int typeCounts[BVH_PRIMITIVE_TYPE_COUNT] = {};
+				for (unsigned int i = 0; i < primitiveRefs.size(); i++) {
+					const BVHPrimitiveType type = BVHPrimitiveRef::Type(primitiveRefs[i]);
+					leafOrderRefs[i] = BVHPrimitiveRef::Make(type, typeCounts[type]++);
+				}
+				referenceSSBO->BufferData(&leafOrderRefs[0], sizeof(unsigned int) * leafOrderRefs.size(), GL_STREAM_COPY);
+			}
+			else {
+				referenceSSBO->BufferData(&primitiveRefs[0], sizeof(unsigned int) * primitiveRefs.size(), GL_STREAM_COPY);
+			}
+		}
+	}
+	void ClearBuffer(ComputeShader& computeShader) const {
+		const ShaderStorageBuffer* bvhSSBO = computeShader.GetSSBO(1);
+		const ShaderStorageBuffer* referenceSSBO = computeShader.GetSSBO(2);
+	
+		bvhSSBO->BufferData(nullptr, (sizeof(BVHNode) * (nodesUsed + 1)) + (sizeof(unsigned int) * HEADER_SIZE), GL_STREAM_COPY);
+		computeShader.GetSSBO(12)->BufferData(nullptr, sizeof(BVHWideNode) * wideTree.size(), GL_STREAM_COPY);
+		computeShader.GetSSBO(13)->BufferData(nullptr, sizeof(BVHCompressedNode) * compressedTree.size(), GL_STREAM_COPY);
+		referenceSSBO->BufferData(nullptr, sizeof(unsigned int) * primitiveRefs.size(), GL_STREAM_COPY);
+	}
+
+	const std::vector<BVHNode>& GetTree() const { return tree; }
+	const std::vector<unsigned int>& GetPrimitiveRefs() const { return primitiveRefs; }
+	unsigned int GetNodesUsed() const { return nodesUsed; }
+	const std::vector<BVHWideNode>& GetWideTree() const { return wideTree; }
+	const std::vector<BVHCompressedNode>& GetCompressedTree() const { return compressedTree; }
+
+	// Copies the primitives of one type into BVH leaf order, matching the indices Buffer uploads when reorderPrimitives is set
+	// Spatial splits can reference a primitive more than once. Scene side arrays keep their order, so names and indices used by the editor stay valid
+	// firstLeafIndices, if given, maps each primitive to its first copy in leafOrder, or BVH_UNREFERENCED_PRIMITIVE if no leaf references it
+	template <typename T>
+	static void PermuteToLeafOrder(const std::vector<T>& primitives, const std::vector<unsigned int>& primitiveRefs, const BVHPrimitiveType type, std::vector<T>& leafOrder, std::vector<unsigned int>* firstLeafIndices = nullptr) {
+		leafOrder.clear();
+		leafOrder.reserve(primitiveRefs.size());
+		if (firstLeafIndices) { firstLeafIndices->assign(primitives.size(), BVH_UNREFERENCED_PRIMITIVE); }
+		for (const unsigned int reference : primitiveRefs) {
+			if (BVHPrimitiveRef::Type(reference) != type) { continue; }
+
+			const unsigned int index = BVHPrimitiveRef::Index(reference);
+			if (firstLeafIndices && (*firstLeafIndices)[index] == BVH_UNREFERENCED_PRIMITIVE) { (*firstLeafIndices)[index] = leafOrder.size(); }
+			leafOrder.push_back(primitives[index]);
+		}
+	}
+
+	// Restructures the current tree to lower its SAH cost without rebuilding, for static scenes that can afford a one off cost
+	const BVHOptimisationStats& OptimiseBVH(const unsigned int passes) {
+		OptimiseTreelets(passes);
+		builtSAHCost = CalculateSAHCost();
+		CollapseWide();
+		return optimisationStats;
+	}
+	const BVHOptimisationStats& GetOptimisationStats() const { return optimisationStats; }
+
+	// Hash of everything a build depends on, identifies a matching cache file
+	unsigned long long GetCacheKey(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) const {
+		unsigned long long hash = 14695981039346656037ull;
+		const unsigned int settings[] = { CACHE_VERSION, (unsigned int)buildMethod, buildSettings.binCount, buildSettings.maxLeafSize, buildSettings.exactSweep, buildSettings.optimisationPasses };
+		const float settingsFloat[] = { buildSettings.traversalCost, spatialSplitBudget };
+		HashBytes(hash, settings, sizeof(settings));
+		HashBytes(hash, settingsFloat, sizeof(settingsFloat));
+		for (const Quad& quad : quads) {
+			const glm::vec4 vertices[] = { quad.GetQ(), quad.GetU(), quad.GetV() };
+			const unsigned int ids[] = { (unsigned int)quad.Normal.a, quad.triangle_disk_id };
+			HashBytes(hash, vertices, sizeof(vertices));
+			HashBytes(hash, ids, sizeof(ids));
+		}
+		for (const Sphere& sphere : spheres) {
+			const glm::vec4 sphereData = glm::vec4(glm::vec3(sphere.Center), sphere.Radius);
+			const unsigned int transformID = sphere.GetTransformID();
+			HashBytes(hash, &sphereData, sizeof(sphereData));
+			HashBytes(hash, &transformID, sizeof(transformID));
+		}
+		if (!transformBuffer.empty()) { HashBytes(hash, &transformBuffer[0], sizeof(glm::mat4) * transformBuffer.size()); }
+		return hash;
+	}
+
+	// Replaces the tree with the one stored in filepath if it was built from the same primitives and settings, returns false if it needs building
+	bool LoadCache(const char* filepath, const unsigned long long cacheKey, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
+		auto start = std::chrono::high_resolution_clock::now();
+		MappedFile file(filepath);
+		if (!file.IsOpen() || file.GetSize() < sizeof(BVHCacheHeader)) { return false; }
+
+		BVHCacheHeader header;
+		memcpy(&header, file.GetData(), sizeof(BVHCacheHeader));
+		if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.cacheKey != cacheKey) { return false; }
+		if (header.quadCount != quads.size() || header.sphereCount != spheres.size() || header.nodeCount < 1) { return false; }
+		const size_t nodeBytes = sizeof(BVHNode) * header.nodeCount;
+		const size_t referenceBytes = sizeof(unsigned int) * header.referenceCount;
+		if (file.GetSize() != sizeof(BVHCacheHeader) + nodeBytes + referenceBytes) { return false; }
+
+		tree.resize(header.nodeCount);
+		primitiveRefs.resize(header.referenceCount);
+		memcpy(&tree[0], file.GetData() + sizeof(BVHCacheHeader), nodeBytes);
+		if (referenceBytes > 0) { memcpy(&primitiveRefs[0], file.GetData() + sizeof(BVHCacheHeader) + nodeBytes, referenceBytes); }
+
+		totalElements = header.quadCount + header.sphereCount;
+		nodesUsed = header.nodeCount - 1;
+		builtQuadCount = header.quadCount;
+		builtSphereCount = header.sphereCount;
+		builtSAHCost = header.builtSAHCost;
+		freePairs.clear();
+		editsPending = false;
+		depthFirstOrder = true;
+		parentsValid = false;
+		rebuildGeneration++;
+		InvalidateStats();
+
+		// A stale or partly written file of the right size must not reach the refit, the wide collapse or the shader, the caller rebuilds instead
+		if (!CachedTreeInRange() || !ValidateCurrent().valid) { return false; }
+
+		// Still needed for refits and edits, both are linear passes
+		primitiveCache.Build(quads, spheres, transformBuffer, primitiveRefs);
+		primitiveSources.FindChanges(quads, spheres, transformBuffer);
+		CollapseWide();
+		buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		loadedFromCache = true;
+		return true;
+	}
+
+	void SaveCache(const char* filepath, const unsigned long long cacheKey) const {
+		if (totalElements == 0) { return; }
+		std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) { return; }
+
+		BVHCacheHeader header;
+		header.magic = CACHE_MAGIC;
+		header.version = CACHE_VERSION;
+		header.cacheKey = cacheKey;
+		header.quadCount = builtQuadCount;
+		header.sphereCount = builtSphereCount;
+		header.nodeCount = nodesUsed + 1;
+		header.referenceCount = primitiveRefs.size();
+		header.builtSAHCost = builtSAHCost;
+		header.padding = 0;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(BVHCacheHeader));
+		file.write(reinterpret_cast<const char*>(&tree[0]), sizeof(BVHNode) * header.nodeCount);
+		if (!primitiveRefs.empty()) { file.write(reinterpret_cast<const char*>(&primitiveRefs[0]), sizeof(unsigned int) * primitiveRefs.size()); }
+	}
+
+	BVHBuildMethod GetBuildMethod() const { return buildMethod; }
+	void SetBuildMethod(const BVHBuildMethod method) { buildMethod = method; }
+
+	const BVHBuildSettings& GetBuildSettings() const { return buildSettings; }
+	void SetBuildSettings(const BVHBuildSettings& settings) {
+		buildSettings = settings;
+		if (buildSettings.binCount < 2) { buildSettings.binCount = 2; }
+		if (buildSettings.binCount > BVHBuildSettings::MAX_BINS) { buildSettings.binCount = BVHBuildSettings::MAX_BINS; }
+		buildSettings.traversalCost = std::max(0.0f, buildSettings.traversalCost);
+		buildSettings.maxLeafSize = std::max(1u, buildSettings.maxLeafSize);
+	}
+	// Preset the current settings were last reset to, individual settings may have been changed since
+	BVHBuildQuality GetBuildQuality() const { return buildQuality; }
+	void SetBuildQuality(const BVHBuildQuality quality) {
+		buildQuality = quality;
+		SetBuildSettings(BVHBuildSettings::FromQuality(quality));
+	}
+
+	// Fractional SAH cost increase from refitting that UpdateBVH tolerates before rebuilding
+	float GetRebuildThreshold() const { return rebuildThreshold; }
+	void SetRebuildThreshold(const float threshold) { rebuildThreshold = std::max(0.0f, threshold); }
+
+	// Updates a background rebuild may take before UpdateBVH waits for it, 0 rebuilds synchronously
+	unsigned int GetMaxRebuildLatency() const { return maxRebuildLatency; }
+	void SetMaxRebuildLatency(const unsigned int updates) { maxRebuildLatency = updates; }
+	bool IsRebuilding() const { return rebuildJob && rebuildJob->thread.joinable(); }
+
+	// SAH cost of the tree relative to its root area, using the build settings' traversal cost
+	float CalculateSAHCost() const {
+		if (totalElements == 0) { return 0.0f; }
+		const float rootArea = tree[rootNodeID].bbox.area();
+		if (rootArea <= 0.0f) { return 0.0f; }
+
+		float cost = 0.0f;
+		for (int i = nodesUsed; i >= 0; i--) {
+			if (i == 1 || i == 2) { continue; } // never used, the first child pair is 3 and 4
+			const BVHNode& node = tree[i];
+			if (node.primitiveCount > 0) { cost += node.primitiveCount * node.bbox.area(); }
+			else if (node.leftChild != 0) { cost += buildSettings.traversalCost * node.bbox.area(); }
+		}
+		return cost / rootArea;
+	}
+
+	// Walks every node reachable from the root, intended for tooling rather than every frame
+	BVHStats GatherStats() const {
+		BVHStats stats;
+		stats.buildMilliseconds = buildMilliseconds;
+		stats.loadedFromCache = loadedFromCache;
+		stats.referenceCount = primitiveRefs.size();
+		stats.sahCost = CalculateSAHCost();
+		if (totalElements == 0 || tree.empty()) { return stats; }
+
+		const float rootArea = tree[rootNodeID].bbox.area();
+		unsigned long long leafDepthSum = 0;
+		float worstLeaf = 0.0f;
+		std::vector<std::pair<unsigned int, unsigned int>> stack; // <node, depth>
+		stack.push_back(std::make_pair(rootNodeID, 0u));
+		while (!stack.empty() && stats.nodeCount < tree.size()) {
+			const unsigned int nodeID = stack.back().first;
+			const unsigned int depth = stack.back().second;
+			stack.pop_back();
+			const BVHNode& node = tree[nodeID];
+			stats.nodeCount++;
+			if (node.isLeaf()) {
+				stats.leafCount++;
+				stats.maxDepth = std::max(stats.maxDepth, depth);
+				stats.largestLeaf = std::max(stats.largestLeaf, node.primitiveCount);
+				stats.leafSizeHistogram[std::min(node.primitiveCount, BVHStats::LEAF_HISTOGRAM_SIZE) - 1]++;
+				worstLeaf = std::max(worstLeaf, node.primitiveCount * node.bbox.area());
+				leafDepthSum += depth;
+				continue;
+			}
+			if (node.leftChild == 0 || node.leftChild + 1 >= tree.size()) { continue; } // Empty node
+
+			// Overlapping siblings are both entered by any ray through the overlap
+			const aabb& left = tree[node.leftChild].bbox;
+			const aabb& right = tree[node.leftChild + 1].bbox;
+			aabb overlap;
+			overlap.aabbMin = glm::max(left.aabbMin, right.aabbMin);
+			overlap.aabbMax = glm::min(left.aabbMax, right.aabbMax);
+			if (glm::all(glm::lessThan(glm::vec3(overlap.aabbMin), glm::vec3(overlap.aabbMax)))) {
+				const float overlapArea = overlap.area();
+				stats.overlapCost += overlapArea;
+				if (node.bbox.area() > 0.0f) { stats.maxOverlap = std::max(stats.maxOverlap, overlapArea / node.bbox.area()); }
+			}
+			stack.push_back(std::make_pair(node.leftChild, depth + 1));
+			stack.push_back(std::make_pair(node.leftChild + 1, depth + 1));
+		}
+
+		if (stats.leafCount > 0) { stats.averageLeafDepth = (float)leafDepthSum / stats.leafCount; }
+		if (rootArea > 0.0f) {
+			stats.overlapCost /= rootArea;
+			if (stats.sahCost > 0.0f) { stats.worstLeafCost = worstLeaf / rootArea / stats.sahCost; }
+		}
+		return stats;
+	}
+
+	// Checks every primitive is reachable from the root and every child's bounds are contained in its parent's
+	BVHValidation Validate() const {
+		BVHValidation result;
+		std::vector<unsigned char> reached(builtQuadCount + builtSphereCount, 0);
+		std::vector<unsigned int> stack;
+		if (totalElements > 0 && !tree.empty()) { stack.push_back(rootNodeID); }
+		unsigned int visited = 0;
+		while (!stack.empty()) {
+			// More nodes than the tree holds means a child index loops back
+			if (++visited > tree.size()) {
+				result.invalidNodes++;
+				break;
+			}
+			const BVHNode& node = tree[stack.back()];
+			stack.pop_back();
+			if (node.isLeaf()) {
+				if (node.primitiveCount > primitiveRefs.size() || node.firstPrimitive > primitiveRefs.size() - node.primitiveCount) {
+					result.invalidNodes++;
+					continue;
+				}
+				for (unsigned int i = node.firstPrimitive; i < node.firstPrimitive + node.primitiveCount; i++) {
+					const unsigned int index = BVHPrimitiveRef::Index(primitiveRefs[i]);
+					const bool isQuad = BVHPrimitiveRef::Type(primitiveRefs[i]) == BVH_PRIMITIVE_QUAD;
+					if (BVHPrimitiveRef::Type(primitiveRefs[i]) >= BVH_PRIMITIVE_TYPE_COUNT || index >= (isQuad ? builtQuadCount : builtSphereCount)) { result.invalidNodes++; }
+					else { reached[isQuad ? index : builtQuadCount + index] = 1; }
+				}
+				continue;
+			}
+			if (node.leftChild == 0) { continue; } // Empty node
+			if (node.leftChild >= tree.size() - 1) {
+				result.invalidNodes++;
+				continue;
+			}
+			for (unsigned int child = node.leftChild; child <= node.leftChild + 1; child++) {
+				const aabb& bounds = tree[child].bbox;
+				const bool empty = bounds.aabbMin.x > bounds.aabbMax.x;
+				const bool contained = glm::all(glm::greaterThanEqual(glm::vec3(bounds.aabbMin), glm::vec3(node.bbox.aabbMin))) && glm::all(glm::lessThanEqual(glm::vec3(bounds.aabbMax), glm::vec3(node.bbox.aabbMax)));
+				if (!empty && !contained) { result.uncontainedChildren++; }
+				stack.push_back(child);
+			}
+		}
+
+		for (const unsigned char r : reached) {
+			if (!r) { result.unreachablePrimitives++; }
+		}
+		result.valid = result.unreachablePrimitives == 0 && result.uncontainedChildren == 0 && result.invalidNodes == 0;
+		return result;
+	}
+
+	// Stats for the current tree, gathered on first use after each build, refit or edit
+	const BVHStats& GetStats() const {
+		if (!statsCurrent) {
+			stats = GatherStats();
+			statsCurrent = true;
+		}
+		return stats;
+	}
+	// Validation is slower so it only runs when asked for, GetValidation returns nullptr once the tree has changed since
+	const BVHValidation& ValidateCurrent() const {
+		validation = Validate();
+		validationCurrent = true;
+		return validation;
+	}
+	const BVHValidation* GetValidation() const { return validationCurrent ? &validation : nullptr; }
+
+	// Extra primitive references a spatial split build may create, as a fraction of the primitive count
+	float GetSpatialSplitBudget() const { return spatialSplitBudget; }
+	void SetSpatialSplitBudget(const float budget) { spatialSplitBudget = std::max(0.0f, budget); }
+
+private:
+	static const unsigned int HEADER_SIZE = 4; // BVH buffer header words before the binary nodes
+	static const int MAX_BINS = BVHBuildSettings::MAX_BINS;
+	static const unsigned int REFIT_CHUNK_SIZE = 1024;
+	static const unsigned int PARALLEL_BUILD_THRESHOLD = 8192;	// Primitive count at which BuildBVH switches to the parallel builder
+	static const unsigned int PARALLEL_BIN_THRESHOLD = 16384;	// Nodes with at least this many primitives are binned across the thread pool
+	static const unsigned int PARALLEL_CHUNK_SIZE = 4096;		// Minimum primitives per chunk when binning in parallel
+	static const unsigned int MIN_TASK_SIZE = 1024;				// Smallest subtree that gets handed to a task during a parallel build
+	static const unsigned int TASKS_PER_THREAD = 4;
+	static const unsigned int MORTON_BITS = 10;					// Bits per axis, 30 bit codes
+	static const unsigned int RADIX_BITS = 10;					// 3 sort passes over 30 bit codes
+	static const int SBVH_SPATIAL_BINS = 32;
+	static const unsigned int PLOC_SEARCH_RADIUS = 16;			// Clusters either side searched for a nearest neighbour
+	static const unsigned int PLOC_MERGED = 0xFFFFFFFFu;		// Cluster slot absorbed by its neighbour this pass
+	static const unsigned int MAX_TREE_DEPTH = 31;				// Shader traversal stack holds 32 entries
+	static const unsigned int TREELET_LEAVES = 7;				// Subsets of 7 leaves keep the treelet search to ~1000 partitions
+	static const unsigned int TREELET_CHUNK_SIZE = 64;			// Minimum treelets per chunk when a depth is optimised in parallel
+	static constexpr float OPTIMISE_MIN_IMPROVEMENT = 1e-4f;	// Relative SAH improvement below which a treelet is left alone, and optimisation stops
+	static constexpr float SBVH_OVERLAP_THRESHOLD = 1e-5f;		// Child overlap, relative to root area, before spatial splits are tried
+
+	// Background rebuild
+	// ------------------
+	// Builds a second BVH on its own thread from a copy of the primitives and transforms, the current tree keeps being refitted and rendered meanwhile.
+	// The finished tree is swapped in on the next update and refitted to the latest primitives. Builds started before an incremental edit or full build are discarded
+	struct BVHRebuildJob {
+		~BVHRebuildJob() {
+			if (thread.joinable()) { thread.join(); }
+		}
+
+		std::vector<Quad> quads;
+		std::vector<Sphere> spheres;
+		std::vector<glm::mat4> transformBuffer;
+		std::unique_ptr<BVH> bvh;
+		std::thread thread;
+		std::atomic<bool> finished;
+		unsigned int generation;
+		unsigned int updatesWaited;
+	};
+
+	// The job and its BVH are kept between rebuilds, so the snapshot copies and the swapped out tree reuse their allocations
+	void StartRebuild(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
+		if (!rebuildJob) {
+			rebuildJob = std::make_shared<BVHRebuildJob>();
+			rebuildJob->bvh.reset(new BVH());
+		}
+		BVHRebuildJob& job = *rebuildJob;
+		job.quads.assign(quads.begin(), quads.end());
+		job.spheres.assign(spheres.begin(), spheres.end());
+		job.transformBuffer.assign(transformBuffer.begin(), transformBuffer.end());
+		job.bvh->SetBuildMethod(buildMethod);
+		job.bvh->SetBuildSettings(buildSettings);
+		job.bvh->SetSpatialSplitBudget(spatialSplitBudget);
+		job.finished = false;
+		job.generation = rebuildGeneration;
+		job.updatesWaited = 0;
+		job.thread = std::thread([&job]() {
+			job.bvh->BuildBVH(job.quads, job.spheres, job.transformBuffer);
+			job.finished.store(true, std::memory_order_release);
+		});
+	}
+
+	// Swaps in a finished rebuild, waiting for it once it has run for maxRebuildLatency updates. Returns true if the tree changed
+	bool UpdateRebuild() {
+		if (!IsRebuilding()) { return false; }
+		BVHRebuildJob& job = *rebuildJob;
+		job.updatesWaited++;
+		if (!job.finished.load(std::memory_order_acquire) && job.updatesWaited <= maxRebuildLatency) { return false; }
+		job.thread.join();
+
+		const bool current = job.generation == rebuildGeneration;
+		if (current) {
+			BVH& built = *job.bvh;
+			tree.swap(built.tree);
+			primitiveRefs.swap(built.primitiveRefs);
+			std::swap(primitiveCache, built.primitiveCache);
+			std::swap(primitiveSources, built.primitiveSources);
+			nodesUsed = built.nodesUsed;
+			builtSAHCost = built.builtSAHCost;
+			buildMilliseconds = built.buildMilliseconds;
+			loadedFromCache = false;
+			optimisationStats = built.optimisationStats;
+			freePairs.clear();
+			depthFirstOrder = true;
+			parentsValid = false;
+			InvalidateStats();
+		}
+		return current;
+	}
+
+	// Cache file
+	// ----------
+	// Header followed by nodes [0, nodesUsed] and the primitive reference list, exactly as they are held in memory
+	static const unsigned int CACHE_MAGIC = 0x42544C47; // "GLTB"
+	static const unsigned int CACHE_VERSION = 1;
+	struct BVHCacheHeader {
+		unsigned int magic;
+		unsigned int version;
+		unsigned long long cacheKey;
+		unsigned int quadCount, sphereCount;
+		unsigned int nodeCount, referenceCount;
+		float builtSAHCost;
+		unsigned int padding;
+	};
+
+	// True if every node refits can reach indexes inside the tree and the reference list, and every reference indexes a built primitive
+	// Validate only follows nodes reachable from the root, refits walk every node
+	bool CachedTreeInRange() const {
+		for (unsigned int i = 0; i <= nodesUsed; i++) {
+			if (i == 1 || i == 2) { continue; } // Never allocated, see ReorderDepthFirst
+			const BVHNode& node = tree[i];
+			if (node.isLeaf()) {
+				if (node.primitiveCount > primitiveRefs.size() || node.firstPrimitive > primitiveRefs.size() - node.primitiveCount) { return false; }
+			}
+			else if (node.leftChild != 0 && node.leftChild >= nodesUsed) { return false; }
+		}
+		for (const unsigned int reference : primitiveRefs) {
+			const BVHPrimitiveType type = BVHPrimitiveRef::Type(reference);
+			if (type >= BVH_PRIMITIVE_TYPE_COUNT || BVHPrimitiveRef::Index(reference) >= (type == BVH_PRIMITIVE_QUAD ? builtQuadCount : builtSphereCount)) { return false; }
+		}
+		return true;
+	}
+
+	// FNV-1a over 8 byte words
+	static void HashBytes(unsigned long long& hash, const void* data, const size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			unsigned long long word;
+			memcpy(&word, bytes + i, 8);
+			hash = (hash ^ word) * 1099511628211ull;
+		}
+		for (; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	}
+
+	// Leaf bounds from the primitive cache, then internal nodes bottom up. Children always have a higher index than their parent
+	void RefitNodes() {
+		InvalidateStats();
+		if (totalElements == 0) { return; }
+		if (!depthFirstOrder) { ReorderDepthFirst(); }
+		ThreadPool::ParallelForRange(nodesUsed + 1, REFIT_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				BVHNode& node = tree[i];
+				if ((i == 1 || i == 2) || !node.isLeaf()) { continue; }
+				node.bbox = aabb();
+				UpdateNodeBounds(node);
+			}
+		});
+		for (int i = nodesUsed; i >= 0; i--) {
+			BVHNode& node = tree[i];
+			if ((i == 1 || i == 2) || node.isLeaf() || node.leftChild == 0) { continue; } // leftChild 0 is an empty node
+			const BVHNode& leftChild = tree[node.leftChild];
+			const BVHNode& rightChild = tree[node.leftChild + 1];
+			node.bbox.aabbMin = glm::min(leftChild.bbox.aabbMin, rightChild.bbox.aabbMin);
+			node.bbox.aabbMax = glm::max(leftChild.bbox.aabbMax, rightChild.bbox.aabbMax);
+		}
+	}
+
+	// Treelet optimisation
+	// --------------------
+	// Every internal node roots a treelet of up to TREELET_LEAVES subtrees, grown by opening the treelet leaf with the largest surface area.
+	// The topology over those subtrees with the lowest SAH cost is found by dynamic programming over subsets and written back into the treelet's own node slots.
+	// Nodes are processed bottom up a depth at a time, treelets rooted at the same depth never overlap so each depth is spread across the pool
+	void OptimiseTreelets(const unsigned int passes) {
+		auto start = std::chrono::high_resolution_clock::now();
+		optimisationStats = BVHOptimisationStats();
+		optimisationStats.sahBefore = CalculateSAHCost();
+		optimisationStats.sahAfter = optimisationStats.sahBefore;
+		if (totalElements == 0 || tree[rootNodeID].isLeaf()) { return; }
+
+		std::vector<std::vector<unsigned int>> levels;
+		std::vector<float> subtreeCost(tree.size(), 0.0f);
+		for (unsigned int pass = 0; pass < passes; pass++) {
+			GatherLevels(levels);
+			const unsigned int depthLimit = std::max(MAX_TREE_DEPTH, (unsigned int)levels.size() - 1);
+			const std::vector<BVHNode> previousTree = tree;
+
+			for (int depth = levels.size() - 1; depth >= 0; depth--) {
+				const std::vector<unsigned int>& level = levels[depth];
+				ThreadPool::ParallelForRange(level.size(), TREELET_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+					for (unsigned int i = begin; i < end; i++) {
+						RestructureTreelet(level[i], subtreeCost);
+					}
+				});
+			}
+
+			// A deeper tree could overflow the shader's traversal stack, keep the previous pass instead
+			if (ReorderDepthFirst() > depthLimit) {
+				tree = previousTree;
+				break;
+			}
 
-		if (nodesUsed > 0 && totalElements > 0) {
-			bvhSSBO->BufferSubData(&tree[0], sizeof(BVHNode) * (nodesUsed + 1), sizeof(unsigned int) * 4);
+			const float cost = CalculateSAHCost();
+			const bool converged = cost > optimisationStats.sahAfter * (1.0f - OPTIMISE_MIN_IMPROVEMENT);
+			optimisationStats.sahAfter = cost;
+			optimisationStats.passes++;
+			if (converged) { break; }
 		}
 
-		// Sphere ID buffer
-		// ----------------
-		if (sphereIDs.size() > 0) {
-			// Initialise buffer
-			sphereSSBO->BufferData(nullptr, sizeof(unsigned int) * sphereIDs.size(), GL_STREAM_COPY);
+		auto end = std::chrono::high_resolution_clock::now();
+		optimisationStats.milliseconds = std::chrono::duration<float, std::milli>(end - start).count();
+	}
+
+	// Node IDs at each depth of the tree, root first
+	void GatherLevels(std::vector<std::vector<unsigned int>>& levels) const {
+		levels.clear();
+		levels.push_back(std::vector<unsigned int>(1, rootNodeID));
+		while (true) {
+			std::vector<unsigned int> next;
+			for (const unsigned int nodeID : levels.back()) {
+				const BVHNode& node = tree[nodeID];
+				if (node.isLeaf() || node.leftChild == 0) { continue; }
+				next.push_back(node.leftChild);
+				next.push_back(node.leftChild + 1);
+			}
+			if (next.empty()) { break; }
+			levels.push_back(std::move(next));
+		}
+	}
+
+	// Replaces the treelet rooted at rootID with its lowest cost topology and records the SAH cost of the subtree
+	// subtreeCost must already hold the cost of every node below rootID
+	void RestructureTreelet(const unsigned int rootID, std::vector<float>& subtreeCost) {
+		BVHNode& root = tree[rootID];
+		if (root.isLeaf()) {
+			subtreeCost[rootID] = root.primitiveCount * root.bbox.area();
+			return;
+		}
+
+		// Grow the treelet, every opened node frees its child pair for the new topology
+		unsigned int leaves[TREELET_LEAVES];
+		unsigned int pairs[TREELET_LEAVES - 1];
+		unsigned int leafCount = 2, pairCount = 1;
+		leaves[0] = root.leftChild;
+		leaves[1] = root.leftChild + 1;
+		pairs[0] = root.leftChild;
+		while (leafCount < TREELET_LEAVES) {
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (unsigned int i = 0; i < leafCount; i++) {
+				const BVHNode& node = tree[leaves[i]];
+				if (!node.isLeaf() && node.bbox.area() > largestArea) {
+					largest = i;
+					largestArea = node.bbox.area();
+				}
+			}
+			if (largest < 0) { break; }
+
+			const unsigned int opened = tree[leaves[largest]].leftChild;
+			pairs[pairCount++] = opened;
+			leaves[largest] = opened;
+			leaves[leafCount++] = opened + 1;
+		}
+
+		const float currentCost = buildSettings.traversalCost * root.bbox.area() + subtreeCost[root.leftChild] + subtreeCost[root.leftChild + 1];
+		if (leafCount < 3) {
+			subtreeCost[rootID] = currentCost;
+			return;
+		}
+
+		// Lowest cost of every subset of the treelet's leaves, subsets of a set are numerically smaller so are always costed first
+		aabb subsetBounds[1 << TREELET_LEAVES];
+		float subsetCost[1 << TREELET_LEAVES];
+		unsigned char subsetSplit[1 << TREELET_LEAVES];
+		const unsigned int subsetCount = 1u << leafCount;
+		for (unsigned int s = 1; s < subsetCount; s++) {
+			const unsigned int lowest = s & (0u - s);
+			unsigned int leafIndex = 0;
+			while (!((lowest >> leafIndex) & 1u)) { leafIndex++; }
+
+			const BVHNode& leaf = tree[leaves[leafIndex]];
+			if (s == lowest) {
+				subsetBounds[s] = leaf.bbox;
+				subsetCost[s] = subtreeCost[leaves[leafIndex]];
+				continue;
+			}
+			subsetBounds[s].aabbMin = glm::min(subsetBounds[s ^ lowest].aabbMin, leaf.bbox.aabbMin);
+			subsetBounds[s].aabbMax = glm::max(subsetBounds[s ^ lowest].aabbMax, leaf.bbox.aabbMax);
+
+			// Only partitions with the lowest leaf on the left, so each split is costed once
+			float bestCost = 1e30f;
+			unsigned int bestSplit = lowest;
+			for (unsigned int p = (s - 1) & s; p != 0; p = (p - 1) & s) {
+				if (!(p & lowest)) { continue; }
+				const float cost = subsetCost[p] + subsetCost[s ^ p];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestSplit = p;
+				}
+			}
+			subsetCost[s] = buildSettings.traversalCost * subsetBounds[s].area() + bestCost;
+			subsetSplit[s] = bestSplit;
+		}
+
+		const unsigned int fullSet = subsetCount - 1;
+		if (!(subsetCost[fullSet] < currentCost * (1.0f - OPTIMISE_MIN_IMPROVEMENT))) {
+			subtreeCost[rootID] = currentCost;
+			return;
+		}
 
-			// Buffer data
-			sphereSSBO->BufferData(&sphereIDs[0], sizeof(unsigned int) * sphereIDs.size(), GL_STREAM_COPY);
+		// Rewrite the treelet, leaf subtrees are moved whole by copying their root node
+		BVHNode leafNodes[TREELET_LEAVES];
+		float leafCosts[TREELET_LEAVES];
+		for (unsigned int i = 0; i < leafCount; i++) {
+			leafNodes[i] = tree[leaves[i]];
+			leafCosts[i] = subtreeCost[leaves[i]];
+		}
+
+		std::pair<unsigned int, unsigned int> stack[TREELET_LEAVES * 2]; // <node slot, subset>
+		unsigned int stackSize = 0, nextPair = 0;
+		stack[stackSize++] = std::make_pair(rootID, fullSet);
+		while (stackSize > 0) {
+			const unsigned int slot = stack[stackSize - 1].first;
+			const unsigned int s = stack[stackSize - 1].second;
+			stackSize--;
+
+			if ((s & (s - 1)) == 0) {
+				unsigned int leafIndex = 0;
+				while (!((s >> leafIndex) & 1u)) { leafIndex++; }
+				tree[slot] = leafNodes[leafIndex];
+				subtreeCost[slot] = leafCosts[leafIndex];
+				continue;
+			}
+
+			const unsigned int pair = pairs[nextPair++];
+			BVHNode& node = tree[slot];
+			node.bbox = subsetBounds[s];
+			node.leftChild = pair;
+			node.firstPrimitive = 0;
+			node.primitiveCount = 0;
+			subtreeCost[slot] = subsetCost[s];
+			stack[stackSize++] = std::make_pair(pair + 1, s ^ subsetSplit[s]);
+			stack[stackSize++] = std::make_pair(pair, (unsigned int)subsetSplit[s]);
+		}
+	}
+
+	// Renumbers nodes in the depth first order Subdivide allocates them in, so children again have a higher index than their parent
+	// Returns the depth of the tree
+	unsigned int ReorderDepthFirst() {
+		struct ReorderEntry {
+			unsigned int source, destination, depth;
+		};
+
+		std::vector<BVHNode> reordered(tree.size());
+		std::vector<ReorderEntry> stack;
+		stack.push_back({ rootNodeID, rootNodeID, 0 });
+		unsigned int nodeCounter = 2, maxDepth = 0;
+		while (!stack.empty()) {
+			const ReorderEntry entry = stack.back();
+			stack.pop_back();
+			maxDepth = std::max(maxDepth, entry.depth);
+
+			BVHNode& node = reordered[entry.destination];
+			node = tree[entry.source];
+			if (node.isLeaf() || node.leftChild == 0) { continue; }
+
+			const unsigned int leftChildID = nodeCounter + 1;
+			nodeCounter += 2;
+			stack.push_back({ node.leftChild + 1, leftChildID + 1, entry.depth + 1 });
+			stack.push_back({ node.leftChild, leftChildID, entry.depth + 1 });
+			node.leftChild = leftChildID;
+		}
+		tree.swap(reordered);
+		nodesUsed = nodeCounter;
+		freePairs.clear();
+		depthFirstOrder = true;
+		parentsValid = false;
+		return maxDepth;
+	}
+
+	// Incremental editing
+	// -------------------
+	// A new primitive gets its own leaf beside the node that increases the tree's surface area least, found by branch and bound from the root.
+	// Removing a primitive erases its references and collapses leaves left empty into their sibling. Freed child pairs are reused by later inserts.
+	// Pairs are no longer allocated depth first after an edit, so the tree is renumbered before the next refit
+	struct SiblingCandidate {
+		unsigned int nodeID;
+		float inheritedCost;	// Area added to the candidate's ancestors
+		float lowerBound;		// Cheapest possible insert anywhere below the candidate
+	};
+
+	unsigned int FindBestSibling(const aabb& bounds) const {
+		const float area = bounds.area();
+		unsigned int bestSibling = rootNodeID;
+		float bestCost = 1e30f;
+
+		auto compare = [](const SiblingCandidate& a, const SiblingCandidate& b) { return a.lowerBound > b.lowerBound; };
+		std::vector<SiblingCandidate> candidates;
+		candidates.push_back({ rootNodeID, 0.0f, area });
+		while (!candidates.empty()) {
+			std::pop_heap(candidates.begin(), candidates.end(), compare);
+			const SiblingCandidate candidate = candidates.back();
+			candidates.pop_back();
+			if (candidate.lowerBound >= bestCost) { break; }
+
+			const BVHNode& node = tree[candidate.nodeID];
+			aabb combined = node.bbox;
+			combined.grow(bounds);
+			const float combinedArea = combined.area();
+			const float cost = combinedArea + candidate.inheritedCost;
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestSibling = candidate.nodeID;
+			}
+
+			if (node.isLeaf() || node.leftChild == 0) { continue; }
+			const float inheritedCost = candidate.inheritedCost + combinedArea - node.bbox.area();
+			if (area + inheritedCost >= bestCost) { continue; }
+			for (unsigned int i = 0; i < 2; i++) {
+				candidates.push_back({ node.leftChild + i, inheritedCost, area + inheritedCost });
+				std::push_heap(candidates.begin(), candidates.end(), compare);
+			}
+		}
+		return bestSibling;
+	}
+
+	// Erases one entry of the reference list and shrinks the leaf that held it
+	void RemoveReference(const unsigned int position) {
+		std::atomic<unsigned int> leafID(0);
+		ThreadPool::ParallelForRange(nodesUsed + 1, REFIT_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				BVHNode& node = tree[i];
+				if ((i == 1 || i == 2) || !node.isLeaf()) { continue; }
+				if (node.firstPrimitive > position) { node.firstPrimitive--; }
+				else if (position < node.firstPrimitive + node.primitiveCount) { leafID = i; }
+			}
+		});
+		primitiveRefs.erase(primitiveRefs.begin() + position);
+		primitiveCache.Erase(position);
+
+		BVHNode& leaf = tree[leafID];
+		leaf.primitiveCount--;
+		if (leaf.primitiveCount > 0) {
+			leaf.bbox = aabb();
+			UpdateNodeBounds(leaf);
+			if (leafID != rootNodeID) { RefitAncestors(parents[leafID]); }
+			return;
+		}
+
+		if (leafID == rootNodeID) {
+			leaf = EmptyNode();
+			nodesUsed = 2;
+			freePairs.clear();
+			return;
+		}
+
+		// Sibling takes the parent's slot
+		const unsigned int parentID = parents[leafID];
+		const unsigned int pair = tree[parentID].leftChild;
+		const unsigned int siblingID = (leafID == pair) ? pair + 1 : pair;
+		tree[parentID] = tree[siblingID];
+		if (!tree[parentID].isLeaf() && tree[parentID].leftChild != 0) {
+			parents[tree[parentID].leftChild] = parentID;
+			parents[tree[parentID].leftChild + 1] = parentID;
+		}
+		tree[pair] = EmptyNode();
+		tree[pair + 1] = EmptyNode();
+		freePairs.push_back(pair);
+		if (parentID != rootNodeID) { RefitAncestors(parents[parentID]); }
+	}
+
+	unsigned int AllocatePair() {
+		if (!freePairs.empty()) {
+			const unsigned int pair = freePairs.back();
+			freePairs.pop_back();
+			return pair;
+		}
+
+		const unsigned int pair = nodesUsed + 1;
+		nodesUsed += 2;
+		if (tree.size() <= nodesUsed) { tree.resize(nodesUsed + 1, EmptyNode()); }
+		if (parents.size() < tree.size()) { parents.resize(tree.size(), 0); }
+		return pair;
+	}
+
+	// Recalculates the bounds of nodeID and everything above it from their children
+	void RefitAncestors(unsigned int nodeID) {
+		while (true) {
+			BVHNode& node = tree[nodeID];
+			if (!node.isLeaf() && node.leftChild != 0) {
+				const BVHNode& leftChild = tree[node.leftChild];
+				const BVHNode& rightChild = tree[node.leftChild + 1];
+				node.bbox.aabbMin = glm::min(leftChild.bbox.aabbMin, rightChild.bbox.aabbMin);
+				node.bbox.aabbMax = glm::max(leftChild.bbox.aabbMax, rightChild.bbox.aabbMax);
+			}
+			if (nodeID == rootNodeID) { return; }
+			nodeID = parents[nodeID];
 		}
+	}
 
-		// Quad ID buffer
-		// --------------
-		if (quadIDs.size() > 0) {
-			// Initialise buffer
-			quadSSBO->BufferData(nullptr, sizeof(unsigned int) * quadIDs.size(), GL_STREAM_COPY);
-
-			// Buffer data
-			quadSSBO->BufferData(&quadIDs[0], sizeof(unsigned int) * quadIDs.size(), GL_STATIC_DRAW);
+	void BuildParents() {
+		if (parentsValid) { return; }
+		parents.assign(tree.size(), 0);
+		for (int i = nodesUsed; i >= 0; i--) {
+			const BVHNode& node = tree[i];
+			if ((i == 1 || i == 2) || node.isLeaf() || node.leftChild == 0) { continue; }
+			parents[node.leftChild] = i;
+			parents[node.leftChild + 1] = i;
 		}
+		parentsValid = true;
 	}
-	void ClearBuffer(ComputeShader& computeShader) const {
-		const ShaderStorageBuffer* bvhSSBO = computeShader.GetSSBO(1);
-		const ShaderStorageBuffer* sphereSSBO = computeShader.GetSSBO(2);
-		const ShaderStorageBuffer* quadSSBO = computeShader.GetSSBO(3);
-	
-		bvhSSBO->BufferData(nullptr, (sizeof(BVHNode) * (nodesUsed + 1)) + (sizeof(unsigned int) * 4), GL_STREAM_COPY);
-		sphereSSBO->BufferData(nullptr, sizeof(unsigned int) * sphereIDs.size(), GL_STREAM_COPY);
-		quadSSBO->BufferData(nullptr, sizeof(unsigned int) * quadIDs.size(), GL_STREAM_COPY);
-	}
-
-	const std::vector<BVHNode>& GetTree() const { return tree; }
-	const std::vector<unsigned int>& GetQuadIDs() const { return quadIDs; }
-	const std::vector<unsigned int>& GetSphereIDs() const { return sphereIDs; }
 
-private:
-	void UpdateNodeBounds(const unsigned int nodeID, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
-		BVHNode& node = tree[nodeID];
-		for (unsigned int first = node.firstQuadPrimitive, i = 0; i < node.quadPrimitiveCount; i++) {
-			const unsigned int quadID = quadIDs[first + i];
-			const Quad& leafQuad = quads[quadID];
-			const glm::mat4& transform = transformBuffer[quads[quadID].Normal.a];
+	// The wide tree is collapsed again by UpdateBVH, the binary tree is uploaded until then
+	void MarkEdited() {
+		wideTree.clear();
+		compressedTree.clear();
+		editsPending = true;
+		depthFirstOrder = false;
+		rebuildGeneration++;
+		InvalidateStats();
+	}
 
-			const glm::vec4& rawQ = leafQuad.GetQ(), rawU = leafQuad.GetU(), rawV = leafQuad.GetV();
+	void InvalidateStats() {
+		statsCurrent = false;
+		validationCurrent = false;
+	}
 
-			// Get world space vertices
-			glm::vec4 worldQ = rawQ;
-			glm::vec4 worldU = glm::vec4(glm::vec3(worldQ + rawU), 1.0f);
-			glm::vec4 worldV = glm::vec4(glm::vec3(worldQ + rawV), 1.0f);
+	static BVHNode EmptyNode() {
+		BVHNode node;
+		node.leftChild = 0;
+		node.firstPrimitive = 0;
+		node.primitiveCount = 0;
+		node.padding = 0;
+		return node;
+	}
 
-			// Transform vertices
-			glm::vec4 transformedWorldQ = transform * worldQ;
-			glm::vec4 transformedWorldU = transform * worldU;
-			glm::vec4 transformedWorldV = transform * worldV;
+	// Wide BVH
+	// --------
+	// Each wide node starts from the two children of a binary node and repeatedly opens the internal child with the largest surface area until it has WIDTH children
+	void CollapseWide() {
+		wideTree.clear();
+		compressedTree.clear();
+		if (!buildSettings.wideBVH || totalElements == 0) { return; }
+
+		std::vector<std::pair<unsigned int, unsigned int>>& stack = collapseStack; // <wide node, binary node>
+		stack.clear();
+		wideTree.push_back(BVHWideNode());
+		stack.push_back(std::make_pair(0u, rootNodeID));
+		while (!stack.empty()) {
+			const unsigned int wideID = stack.back().first;
+			const unsigned int nodeID = stack.back().second;
+			stack.pop_back();
+
+			unsigned int children[BVHWideNode::WIDTH];
+			unsigned int childCount = 0;
+			if (tree[nodeID].isLeaf()) {
+				children[childCount++] = nodeID;
+			}
+			else {
+				children[childCount++] = tree[nodeID].leftChild;
+				children[childCount++] = tree[nodeID].leftChild + 1;
+			}
+			while (childCount < BVHWideNode::WIDTH) {
+				int largest = -1;
+				float largestArea = -1.0f;
+				for (unsigned int i = 0; i < childCount; i++) {
+					const BVHNode& child = tree[children[i]];
+					if (child.isLeaf() || child.leftChild == 0) { continue; }
+					if (child.bbox.area() > largestArea) {
+						largestArea = child.bbox.area();
+						largest = i;
+					}
+				}
+				if (largest == -1) { break; }
+				const unsigned int opened = tree[children[largest]].leftChild;
+				children[largest] = opened;
+				children[childCount++] = opened + 1;
+			}
 
-			const glm::vec4 Q = transformedWorldQ;
-			const glm::vec4 U = transformedWorldU - transformedWorldQ;
-			const glm::vec4 V = transformedWorldV - transformedWorldQ;
+			BVHWideNode wideNode;
+			wideNode.childMinX = wideNode.childMinY = wideNode.childMinZ = glm::vec4(1e30f);
+			wideNode.childMaxX = wideNode.childMaxY = wideNode.childMaxZ = glm::vec4(-1e30f);
+			wideNode.child = glm::uvec4(BVHWideNode::INVALID_CHILD);
+			wideNode.counts = glm::uvec4(0u);
+			for (unsigned int i = 0; i < childCount; i++) {
+				const BVHNode& child = tree[children[i]];
+				if (!child.isLeaf() && child.leftChild == 0) { continue; } // empty node
+				wideNode.childMinX[i] = child.bbox.aabbMin.x;
+				wideNode.childMinY[i] = child.bbox.aabbMin.y;
+				wideNode.childMinZ[i] = child.bbox.aabbMin.z;
+				wideNode.childMaxX[i] = child.bbox.aabbMax.x;
+				wideNode.childMaxY[i] = child.bbox.aabbMax.y;
+				wideNode.childMaxZ[i] = child.bbox.aabbMax.z;
+				if (child.isLeaf()) {
+					wideNode.child[i] = child.firstPrimitive;
+					wideNode.counts[i] = child.primitiveCount;
+				}
+				else {
+					wideNode.child[i] = wideTree.size();
+					wideTree.push_back(BVHWideNode());
+				}
+			}
+			wideTree[wideID] = wideNode;
 
-			const glm::vec4 QU = Q + U;
-			const glm::vec4 QV = Q + V;
-			const glm::vec4 QUV = Q + U + V;
+			// Sibling groups are contiguous and pushed in reverse, so the tree is laid out depth first in lane order
+			for (int i = childCount - 1; i >= 0; i--) {
+				if (wideNode.counts[i] == 0 && wideNode.child[i] != BVHWideNode::INVALID_CHILD) {
+					stack.push_back(std::make_pair(wideNode.child[i], children[i]));
+				}
+			}
+		}
 
-			node.bbox.grow(Q);
-			node.bbox.grow(QU);
-			node.bbox.grow(QV);
+		if (buildSettings.compressWideBVH) {
+			// The shader reads one format for the whole tree, so a single node that can't be quantised uploads the uncompressed tree
+			std::atomic<bool> encoded(true);
+			compressedTree.resize(wideTree.size());
+			ThreadPool::ParallelForRange(wideTree.size(), REFIT_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+				for (unsigned int i = begin; i < end && encoded; i++) {
+					if (!BVHCompressedNode::Encode(wideTree[i], compressedTree[i])) { encoded = false; }
+				}
+			});
+			if (!encoded) { compressedTree.clear(); }
+		}
+	}
 
-			if (leafQuad.triangle_disk_id != 1u) { // if not a triangleh
-				node.bbox.grow(QUV);
+	// Builders partition every primitive type together, this then groups each leaf's references by type so the shader's leaf loop branches less
+	void SortLeavesByType() {
+		ThreadPool::ParallelForRange(nodesUsed + 1, REFIT_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				if ((i == 1 || i == 2) || !tree[i].isLeaf()) { continue; }
+				unsigned int first = tree[i].firstPrimitive;
+				const unsigned int last = first + tree[i].primitiveCount;
+				for (unsigned int type = 0; type + 1 < BVH_PRIMITIVE_TYPE_COUNT; type++) {
+					for (unsigned int j = first; j < last; j++) {
+						if (BVHPrimitiveRef::Type(primitiveRefs[j]) != type) { continue; }
+						std::swap(primitiveRefs[first], primitiveRefs[j]);
+						primitiveCache.Swap(first++, j);
+					}
+				}
 			}
+		});
+	}
 
-			if (leafQuad.triangle_disk_id == 2u) {
-				node.bbox.grow(Q - U);
-				node.bbox.grow(Q - V);
-				node.bbox.grow(Q - (U + V));
-				node.bbox.grow(Q - (U - V));
+	void GrowBounds(aabb& bounds, const unsigned int cacheBegin, const unsigned int cacheEnd) const {
+		for (int a = 0; a < 3; a++) {
+			const float* primitiveMin = primitiveCache.boundsMin[a].data();
+			const float* primitiveMax = primitiveCache.boundsMax[a].data();
+			float boundsMin = bounds.aabbMin[a], boundsMax = bounds.aabbMax[a];
+			for (unsigned int i = cacheBegin; i < cacheEnd; i++) {
+				boundsMin = std::min(boundsMin, primitiveMin[i]);
+				boundsMax = std::max(boundsMax, primitiveMax[i]);
 			}
+			bounds.aabbMin[a] = boundsMin;
+			bounds.aabbMax[a] = boundsMax;
 		}
-		for (unsigned int first = node.firstSpherePrimitive, i = 0; i < node.spherePrimitiveCount; i++) {
-			const unsigned int sphereID = sphereIDs[first + i];
-			const Sphere& leafSphere = spheres[sphereID];
-			const glm::mat4& transform = transformBuffer[spheres[sphereID].GetTransformID()];
-
-			const glm::vec4& center = transform * leafSphere.Center;
-			const float sphereRadius = leafSphere.Radius;
+	}
 
-			const glm::vec3 sphereMin = glm::vec3(center) - glm::vec3(sphereRadius), sphereMax = glm::vec3(center) + glm::vec3(sphereRadius);
+	void UpdateNodeBounds(BVHNode& node) const {
+		GrowBounds(node.bbox, node.firstPrimitive, node.firstPrimitive + node.primitiveCount);
+	}
 
-			node.bbox.grow(glm::vec4(sphereMin, 1.0f));
-			node.bbox.grow(glm::vec4(sphereMax, 1.0f));
+	void UpdateNodeBoundsParallel(BVHNode& node) const {
+		const unsigned int primitiveCount = node.primitiveCount;
+		if (primitiveCount < PARALLEL_BIN_THRESHOLD) {
+			UpdateNodeBounds(node);
+			return;
 		}
+
+		// min / max is order independent so the merged result matches the serial bounds exactly
+		std::mutex chunkMutex;
+		ThreadPool::ParallelForRange(primitiveCount, PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			aabb bounds;
+			GrowBounds(bounds, node.firstPrimitive + begin, node.firstPrimitive + end);
+			std::lock_guard<std::mutex> lock(chunkMutex);
+			node.bbox.grow(bounds);
+		});
 	}
 
 	float EvaluateSAH(const BVHNode& node, const int axis, const float pos, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
 		aabb leftAABB, rightAABB;
 		int leftCount = 0, rightCount = 0;
-		for (unsigned int i = 0; i < node.quadPrimitiveCount; i++) {
-			const Quad& quad = quads[quadIDs[node.firstQuadPrimitive + i]];
-			const glm::mat4& transform = transformBuffer[quads[quadIDs[node.firstQuadPrimitive + i]].Normal.a];
-
-			const glm::vec4& rawQ = quad.GetQ(), rawU = quad.GetU(), rawV = quad.GetV();
-			// Get world space vertices
-			glm::vec4 worldQ = rawQ;
-			glm::vec4 worldU = glm::vec4(glm::vec3(worldQ + rawU), 1.0f);
-			glm::vec4 worldV = glm::vec4(glm::vec3(worldQ + rawV), 1.0f);
-
-			// Transform vertices
-			glm::vec4 transformedWorldQ = transform * worldQ;
-			glm::vec4 transformedWorldU = transform * worldU;
-			glm::vec4 transformedWorldV = transform * worldV;
-
-			const glm::vec4 Q = transformedWorldQ;
-			const glm::vec4 U = transformedWorldU - transformedWorldQ;
-			const glm::vec4 V = transformedWorldV - transformedWorldQ;
-
-			const glm::vec4 QU = Q + U;
-			const glm::vec4 QV = Q + V;
-			const glm::vec4 QUV = Q + U + V;
-
-			if ((transform * quad.GetCentre())[axis] < pos) {
-				leftCount++;
-
-				leftAABB.grow(Q);
-				leftAABB.grow(QU);
-				leftAABB.grow(QV);
-
-				if (quad.triangle_disk_id != 1u) { // if not a triangleh
-					leftAABB.grow(QUV);
-				}
-
-				if (quad.triangle_disk_id == 2u) {
-					leftAABB.grow(Q - U);
-					leftAABB.grow(Q - V);
-					leftAABB.grow(Q - (U + V));
-					leftAABB.grow(Q - (U - V));
-				}
+		for (unsigned int i = 0; i < node.primitiveCount; i++) {
+			const unsigned int reference = primitiveRefs[node.firstPrimitive + i];
+			const unsigned int index = BVHPrimitiveRef::Index(reference);
+
+			aabb bounds;
+			glm::vec4 centre;
+			if (BVHPrimitiveRef::Type(reference) == BVH_PRIMITIVE_QUAD) {
+				const glm::mat4& transform = transformBuffer[quads[index].Normal.a];
+				bounds = BVHPrimitiveCache::GetQuadBounds(quads[index], transform);
+				centre = transform * quads[index].GetCentre();
 			}
 			else {
-				rightCount++;
-
-				rightAABB.grow(Q);
-				rightAABB.grow(QU);
-				rightAABB.grow(QV);
-
-				if (quad.triangle_disk_id != 1u) { // if not a triangleh
-					rightAABB.grow(QUV);
-				}
-
-				if (quad.triangle_disk_id == 2u) {
-					rightAABB.grow(Q - U);
-					rightAABB.grow(Q - V);
-					rightAABB.grow(Q - (U + V));
-					rightAABB.grow(Q - (U - V));
-				}
+				const glm::mat4& transform = transformBuffer[spheres[index].GetTransformID()];
+				bounds = BVHPrimitiveCache::GetSphereBounds(spheres[index], transform);
+				centre = transform * spheres[index].Center;
 			}
-		}
-		for (unsigned int i = 0; i < node.spherePrimitiveCount; i++) {
-			const Sphere& sphere = spheres[sphereIDs[node.firstSpherePrimitive + i]];
-			const glm::mat4& transform = transformBuffer[spheres[sphereIDs[node.firstSpherePrimitive + i]].GetTransformID()];
 
-			const glm::vec4& center = transform * sphere.Center;
-			const float sphereRadius = sphere.Radius;
-
-			const glm::vec3 sphereMin = center - glm::vec4(sphereRadius, sphereRadius, sphereRadius, 0.0f);
-			const glm::vec3 sphereMax = center + glm::vec4(sphereRadius, sphereRadius, sphereRadius, 0.0f);
-
-			if (sphere.Center[axis] < pos) {
+			if (centre[axis] < pos) {
 				leftCount++;
-				
-				leftAABB.grow(sphereMin);
-				leftAABB.grow(sphereMax);
+				leftAABB.grow(bounds);
 			}
 			else {
 				rightCount++;
-
-				rightAABB.grow(sphereMin);
-				rightAABB.grow(sphereMax);
+				rightAABB.grow(bounds);
 			}
 		}
 		float leftBoxArea = leftAABB.area();
@@ -320,157 +1692,97 @@ private:
 		return cost > 0 ? cost : 1e30f;
 	}
 
-	/*
-	float FindBestSplitPlane(const BVHNode& node, int& axis, float& splitPos, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres) {
-		float bestCost = 1e30f;
+	void GetCentroidBounds(const BVHNode& node, const unsigned int begin, const unsigned int end, glm::vec3& centroidMin, glm::vec3& centroidMax) const {
 		for (int a = 0; a < 3; a++) {
-			for (unsigned int i = 0; i < node.quadPrimitiveCount; i++) {
-				const Quad& quad = quads[quadIDs[node.firstQuadPrimitive + i]];
-				float candidatePos = quad.GetCentre()[a];
-				float cost = EvaluateSAH(node, a, candidatePos, quads, spheres);
-				if (cost < bestCost) {
-					splitPos = candidatePos;
-					axis = a;
-					bestCost = cost;
-				}
-			}
-			for (unsigned int i = 0; i < node.spherePrimitiveCount; i++) {
-				const Sphere& sphere = spheres[sphereIDs[node.firstSpherePrimitive + i]];
-				float candidatePos = sphere.Center[a];
-				float cost = EvaluateSAH(node, a, candidatePos, quads, spheres);
-				if (cost < bestCost) {
-					splitPos = candidatePos;
-					axis = a;
-					bestCost = cost;
-				}
+			const float* centre = primitiveCache.centre[a].data();
+			float boundsMin = centroidMin[a], boundsMax = centroidMax[a];
+			for (unsigned int i = node.firstPrimitive + begin; i < node.firstPrimitive + end; i++) {
+				boundsMin = std::min(boundsMin, centre[i]);
+				boundsMax = std::max(boundsMax, centre[i]);
 			}
+			centroidMin[a] = boundsMin;
+			centroidMax[a] = boundsMax;
 		}
-		return bestCost;
 	}
-	*/
 
-	/*
-	float FindBestSplitPlane(const BVHNode& node, int& axis, float& splitPos, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres) {
-		float bestCost = 1e30f;
-		const int interval = 4;
+	void BinPrimitives(const BVHNode& node, const unsigned int begin, const unsigned int end, const glm::vec3& centroidMin, const glm::vec3& centroidMax, Bin (&bins)[3][MAX_BINS]) const {
+		const int binCount = buildSettings.binCount;
 		for (int a = 0; a < 3; a++) {
-			float boundsMin = node.bbox.aabbMin[a];
-			float boundsMax = node.bbox.aabbMax[a];
-			if (boundsMin == boundsMax) { continue; }
-			float scale = (boundsMax - boundsMin) / interval;
-			for (unsigned int i = 1; i < interval; i++) {
-				float candidatePos = boundsMin + i * scale;
-				float cost = EvaluateSAH(node, a, candidatePos, quads, spheres);
-				if (cost < bestCost) {
-					splitPos = candidatePos;
-					axis = a;
-					bestCost = cost;
+			if (centroidMin[a] == centroidMax[a]) { continue; }
+			const float scale = binCount / (centroidMax[a] - centroidMin[a]);
+			const float* centre = primitiveCache.centre[a].data();
+			for (unsigned int i = node.firstPrimitive + begin; i < node.firstPrimitive + end; i++) {
+				const int binID = std::min(binCount - 1, (int)((centre[i] - centroidMin[a]) * scale));
+				Bin& bin = bins[a][binID];
+				bin.count++;
+				for (int b = 0; b < 3; b++) {
+					bin.bounds.aabbMin[b] = std::min(bin.bounds.aabbMin[b], primitiveCache.boundsMin[b][i]);
+					bin.bounds.aabbMax[b] = std::max(bin.bounds.aabbMax[b], primitiveCache.boundsMax[b][i]);
 				}
 			}
 		}
-		return bestCost;
 	}
-	*/
-	
-	float FindBestSplitPlane(const BVHNode& node, int& axis, float& splitPos, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
-		float bestCost = 1e30f;
-		for (int a = 0; a < 3; a++) {
-			float boundsMin = 1e30f, boundsMax = -1e30f;
-			for (int i = 0; i < node.quadPrimitiveCount; i++) {
-				const Quad& quad = quads[quadIDs[node.firstQuadPrimitive + i]];
-				const glm::mat4& transform = transformBuffer[quads[quadIDs[node.firstQuadPrimitive + i]].Normal.a];
-				boundsMin = std::min(boundsMin, (transform * quad.GetCentre())[a]);
-				boundsMax = std::max(boundsMax, (transform * quad.GetCentre())[a]);
-			}
-			for (int i = 0; i < node.spherePrimitiveCount; i++) {
-				const Sphere& sphere = spheres[sphereIDs[node.firstSpherePrimitive + i]];
-				const glm::mat4& transform = transformBuffer[spheres[sphereIDs[node.firstSpherePrimitive + i]].GetTransformID()];
-				boundsMin = std::min(boundsMin, (transform * sphere.Center)[a]);
-				boundsMax = std::max(boundsMax, (transform * sphere.Center)[a]);
-			}
-			if (boundsMin == boundsMax) { continue; }
-			// populate bins
-			const int BINS = 8;
-			Bin bin[BINS];
-			float scale = BINS / (boundsMax - boundsMin);
-			// Quads
-			for (unsigned int i = 0; i < node.quadPrimitiveCount; i++) {
-				const Quad& quad = quads[quadIDs[node.firstQuadPrimitive + i]];
-				const glm::mat4& transform = transformBuffer[quads[quadIDs[node.firstQuadPrimitive + i]].Normal.a];
-
-				const int binID = std::min(BINS - 1, (int)(((transform * quad.GetCentre())[a] - boundsMin) * scale));
-				bin[binID].quadCount++;
-
-				const glm::vec4& rawQ = quad.GetQ(), rawU = quad.GetU(), rawV = quad.GetV();
-				// Get world space vertices
-				glm::vec4 worldQ = rawQ;
-				glm::vec4 worldU = glm::vec4(glm::vec3(worldQ + rawU), 1.0f);
-				glm::vec4 worldV = glm::vec4(glm::vec3(worldQ + rawV), 1.0f);
-
-				// Transform vertices
-				glm::vec4 transformedWorldQ = transform * worldQ;
-				glm::vec4 transformedWorldU = transform * worldU;
-				glm::vec4 transformedWorldV = transform * worldV;
-
-				const glm::vec4 Q = transformedWorldQ;
-				const glm::vec4 U = transformedWorldU - transformedWorldQ;
-				const glm::vec4 V = transformedWorldV - transformedWorldQ;
-
-				const glm::vec4 QU = Q + U;
-				const glm::vec4 QV = Q + V;
-				const glm::vec4 QUV = Q + U + V;
-
-				bin[binID].bounds.grow(Q);
-				bin[binID].bounds.grow(QU);
-				bin[binID].bounds.grow(QV);
-
-				if (quad.triangle_disk_id != 1u) { // if not a triangleh
-					bin[binID].bounds.grow(QUV);
-				}
 
-				if (quad.triangle_disk_id == 2u) {
-					bin[binID].bounds.grow(Q - U);
-					bin[binID].bounds.grow(Q - V);
-					bin[binID].bounds.grow(Q - (U + V));
-					bin[binID].bounds.grow(Q - (U - V));
+	float FindBestSplitPlane(const BVHNode& node, int& axis, float& splitPos, const bool parallel) const {
+		if (buildSettings.exactSweep) { return FindBestSplitPlaneSweep(node, axis, splitPos, parallel); }
+
+		const unsigned int primitiveCount = node.primitiveCount;
+		const int binCount = buildSettings.binCount;
+		glm::vec3 centroidMin = glm::vec3(1e30f), centroidMax = glm::vec3(-1e30f);
+		Bin bin[3][MAX_BINS];
+
+		if (parallel && primitiveCount >= PARALLEL_BIN_THRESHOLD) {
+			// Each chunk gathers its own centroid bounds and bins, which are then merged
+			// Counts and min / max bounds are order independent so the result matches the serial path exactly
+			std::mutex mergeMutex;
+			ThreadPool::ParallelForRange(primitiveCount, PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+				glm::vec3 chunkMin = glm::vec3(1e30f), chunkMax = glm::vec3(-1e30f);
+				GetCentroidBounds(node, begin, end, chunkMin, chunkMax);
+				std::lock_guard<std::mutex> lock(mergeMutex);
+				centroidMin = glm::min(centroidMin, chunkMin);
+				centroidMax = glm::max(centroidMax, chunkMax);
+			});
+			ThreadPool::ParallelForRange(primitiveCount, PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+				Bin chunkBins[3][MAX_BINS];
+				BinPrimitives(node, begin, end, centroidMin, centroidMax, chunkBins);
+				std::lock_guard<std::mutex> lock(mergeMutex);
+				for (int a = 0; a < 3; a++) {
+					for (int i = 0; i < binCount; i++) {
+						bin[a][i].count += chunkBins[a][i].count;
+						bin[a][i].bounds.grow(chunkBins[a][i].bounds);
+					}
 				}
-			}
-			// Spheres
-			for (unsigned int i = 0; i < node.spherePrimitiveCount; i++) {
-				const Sphere& sphere = spheres[sphereIDs[node.firstSpherePrimitive + i]];
-				const glm::mat4& transform = transformBuffer[spheres[sphereIDs[node.firstSpherePrimitive + i]].GetTransformID()];
-
-				const int binID = std::min(BINS - 1, (int)(((transform * sphere.Center)[a] - boundsMin) * scale));
-				bin[binID].sphereCount++;
-
-				const glm::vec4& center = transform * sphere.Center;
-				const float sphereRadius = sphere.Radius;
+			});
+		}
+		else {
+			GetCentroidBounds(node, 0, primitiveCount, centroidMin, centroidMax);
+			BinPrimitives(node, 0, primitiveCount, centroidMin, centroidMax, bin);
+		}
 
-				const glm::vec3 sphereMin = center - glm::vec4(sphereRadius, sphereRadius, sphereRadius, 0.0f);
-				const glm::vec3 sphereMax = center + glm::vec4(sphereRadius, sphereRadius, sphereRadius, 0.0f);
+		float bestCost = 1e30f;
+		for (int a = 0; a < 3; a++) {
+			const float boundsMin = centroidMin[a], boundsMax = centroidMax[a];
+			if (boundsMin == boundsMax) { continue; }
 
-				bin[binID].bounds.grow(sphereMin);
-				bin[binID].bounds.grow(sphereMax);
-			}
 			// gather data for planes between bins
-			float leftArea[BINS - 1], rightArea[BINS - 1];
-			int leftCount[BINS - 1], rightCount[BINS - 1];
+			float leftArea[MAX_BINS - 1], rightArea[MAX_BINS - 1];
+			int leftCount[MAX_BINS - 1], rightCount[MAX_BINS - 1];
 			aabb leftBox, rightBox;
 			int leftSum = 0, rightSum = 0;
-			for (int i = 0; i < BINS - 1; i++) {
-				leftSum += bin[i].quadCount + bin[i].sphereCount;
+			for (int i = 0; i < binCount - 1; i++) {
+				leftSum += bin[a][i].count;
 				leftCount[i] = leftSum;
-				leftBox.grow(bin[i].bounds);
+				leftBox.grow(bin[a][i].bounds);
 				leftArea[i] = leftBox.area();
 
-				rightSum += bin[BINS - 1 - i].quadCount + bin[BINS - 1 - i].sphereCount;
-				rightCount[BINS - 2 - i] = rightSum;
-				rightBox.grow(bin[BINS - 1 - i].bounds);
-				rightArea[BINS - 2 - i] = rightBox.area();
+				rightSum += bin[a][binCount - 1 - i].count;
+				rightCount[binCount - 2 - i] = rightSum;
+				rightBox.grow(bin[a][binCount - 1 - i].bounds);
+				rightArea[binCount - 2 - i] = rightBox.area();
 			}
 			// calculate SAH cost for planes
-			scale = (boundsMax - boundsMin) / BINS;
-			for (int i = 0; i < BINS - 1; i++) {
+			const float scale = (boundsMax - boundsMin) / binCount;
+			for (int i = 0; i < binCount - 1; i++) {
 				float planeCost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
 				if (planeCost < bestCost) {
 					axis = a;
@@ -481,184 +1793,1006 @@ private:
 		}
 		return bestCost;
 	}
+
+	// Per thread scratch for the exact sweep, grows to the largest node the thread has swept and is then reused
+	struct BVHSweepScratch {
+		std::vector<unsigned int> order;
+		std::vector<float> rightArea;
+	};
+	static BVHSweepScratch& GetSweepScratch() {
+		static thread_local BVHSweepScratch scratch;
+		return scratch;
+	}
+
+	// Exact SAH, sorts the node's centroids on each axis and scans prefix / suffix bounds to cost every boundary between primitives
+	float FindBestSplitPlaneSweep(const BVHNode& node, int& axis, float& splitPos, const bool parallel) const {
+		const unsigned int primitiveCount = node.primitiveCount;
+		if (primitiveCount < 2) { return 1e30f; }
+		float bestCost[3] = { 1e30f, 1e30f, 1e30f };
+		float bestPos[3];
+
+		auto sweepAxis = [&](const unsigned int a) {
+			const float* centre = primitiveCache.centre[a].data();
+			BVHSweepScratch& scratch = GetSweepScratch();
+			if (scratch.order.size() < primitiveCount) {
+				scratch.order.resize(primitiveCount);
+				scratch.rightArea.resize(primitiveCount);
+			}
+			unsigned int* order = scratch.order.data();
+			float* rightArea = scratch.rightArea.data();
+			for (unsigned int i = 0; i < primitiveCount; i++) { order[i] = node.firstPrimitive + i; }
+			std::sort(order, order + primitiveCount, [&](const unsigned int i, const unsigned int j) {
+				return centre[i] < centre[j] || (centre[i] == centre[j] && i < j);
+			});
+
+			aabb rightBox;
+			for (unsigned int k = primitiveCount - 1; k > 0; k--) {
+				GrowBounds(rightBox, order[k], order[k] + 1);
+				rightArea[k] = rightBox.area();
+			}
+
+			// Only boundaries between distinct centroids can be reproduced by partitioning on splitPos
+			aabb leftBox;
+			for (unsigned int k = 0; k < primitiveCount - 1; k++) {
+				GrowBounds(leftBox, order[k], order[k] + 1);
+				if (centre[order[k]] == centre[order[k + 1]]) { continue; }
+				const float planeCost = (k + 1) * leftBox.area() + (primitiveCount - k - 1) * rightArea[k + 1];
+				if (planeCost < bestCost[a]) {
+					bestCost[a] = planeCost;
+					bestPos[a] = centre[order[k + 1]];
+				}
+			}
+		};
+
+		if (parallel && primitiveCount >= PARALLEL_BIN_THRESHOLD) { ThreadPool::ParallelFor(3, sweepAxis); }
+		else {
+			for (unsigned int a = 0; a < 3; a++) { sweepAxis(a); }
+		}
+
+		float cost = 1e30f;
+		for (int a = 0; a < 3; a++) {
+			if (bestCost[a] < cost) {
+				cost = bestCost[a];
+				axis = a;
+				splitPos = bestPos[a];
+			}
+		}
+		return cost;
+	}
 	
-	float CalculateNodeCost(const BVHNode& node) {
+	float CalculateNodeCost(const BVHNode& node) const {
 		float parentArea = node.bbox.area();
-		return (node.quadPrimitiveCount + node.spherePrimitiveCount) * parentArea;
+		return node.primitiveCount * parentArea;
 	}
 
-	void Subdivide(const unsigned int nodeID, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
-		BVHNode& node = tree[nodeID];
-
+	// Splits node into the two given (default constructed) child nodes, returns false if node should remain a leaf
+	bool SplitNode(BVHNode& node, BVHNode& leftChild, BVHNode& rightChild, const bool parallel) {
 		// Determine split axis using SAH
-		int axis;
+		int axis = -1;
 		float splitPos;
-		float splitCost = FindBestSplitPlane(node, axis, splitPos, quads, spheres, transformBuffer);
+		float splitCost = FindBestSplitPlane(node, axis, splitPos, parallel);
+		if (axis < 0) { return false; } // Every centroid is the same, nothing to split on
+		splitCost += buildSettings.traversalCost * node.bbox.area();
 
 		// Get parent area
 		float parentCost = CalculateNodeCost(node);
-		if (splitCost >= parentCost) { return; } // Further splits will be detrimental. Return
-
-		// Split node quads
-		//const int BINS = 8;
-		//const float scale = BINS / (node.bbox.aabbMax[axis] - node.bbox.aabbMin[axis]);
-
-		int quadI = node.firstQuadPrimitive;
-		int quadJ = quadI + node.quadPrimitiveCount - 1;
-		while (quadI <= quadJ) {
-			//const int binID = std::min(BINS - 1, (int)((quads[quadIDs[quadI]].GetCentre()[axis] - node.bbox.aabbMin[axis]) * scale));
-			//if (binID < splitPos) { quadI++; }
-			//else { std::swap(quadIDs[quadI], quadIDs[quadJ--]); }
-			const glm::mat4& transform = transformBuffer[quads[quadIDs[quadI]].Normal.a];
-			if ((transform * quads[quadIDs[quadI]].GetCentre())[axis] < splitPos) { quadI++; }
-			else { std::swap(quadIDs[quadI], quadIDs[quadJ--]); }
-		}
-		// Split node spheres
-		int sphereI = node.firstSpherePrimitive;
-		int sphereJ = sphereI + node.spherePrimitiveCount - 1;
-		while (sphereI <= sphereJ) {
-			//const int binID = std::min(BINS - 1, (int)((spheres[sphereIDs[sphereI]].Center[axis] - node.bbox.aabbMin[axis]) * scale));
-			//if (binID < splitPos) { sphereI++; }
-			//else { std::swap(sphereIDs[sphereI], sphereIDs[sphereJ--]); }
-			const glm::mat4& transform = transformBuffer[spheres[sphereIDs[sphereI]].GetTransformID()];
-			if ((transform * spheres[sphereIDs[sphereI]].Center)[axis] < splitPos) { sphereI++; }
-			else { std::swap(sphereIDs[sphereI], sphereIDs[sphereJ--]); }
-		}
-
-		int leftQuadCount = quadI - node.firstQuadPrimitive;
-		int leftSphereCount = sphereI - node.firstSpherePrimitive;
-
-		if (leftQuadCount + leftSphereCount == 0) { return; }
+		const bool overfull = node.primitiveCount > buildSettings.maxLeafSize;
+		if (splitCost >= parentCost && !overfull) { return false; } // Further splits will be detrimental. Return
+
+		// Split node primitives
+		const float* centre = primitiveCache.centre[axis].data();
+		int i = node.firstPrimitive;
+		int j = i + node.primitiveCount - 1;
+		while (i <= j) {
+			if (centre[i] < splitPos) { i++; }
+			else {
+				std::swap(primitiveRefs[i], primitiveRefs[j]);
+				primitiveCache.Swap(i, j--);
+			}
+		}
+
+		const unsigned int leftCount = i - node.firstPrimitive;
+		if (leftCount == 0 || leftCount == node.primitiveCount) { return false; }
 
 		// Create child nodes
-		int leftChildID = ++nodesUsed;
-		int rightChildID = ++nodesUsed;
-		node.leftChild = leftChildID;
+		leftChild = BVHNode();
+		rightChild = BVHNode();
+		leftChild.firstPrimitive = node.firstPrimitive;
+		leftChild.primitiveCount = leftCount;
+		leftChild.padding = 0;
+		rightChild.firstPrimitive = i;
+		rightChild.primitiveCount = node.primitiveCount - leftCount;
+		rightChild.padding = 0;
+		node.primitiveCount = 0;
+
+		if (parallel) {
+			UpdateNodeBoundsParallel(leftChild);
+			UpdateNodeBoundsParallel(rightChild);
+		}
+		else {
+			UpdateNodeBounds(leftChild);
+			UpdateNodeBounds(rightChild);
+		}
+		return true;
+	}
 
-		tree[leftChildID].firstQuadPrimitive = node.firstQuadPrimitive;
-		tree[leftChildID].quadPrimitiveCount = leftQuadCount;
-		tree[leftChildID].firstSpherePrimitive = node.firstSpherePrimitive;
-		tree[leftChildID].spherePrimitiveCount = leftSphereCount;
-		tree[leftChildID].padding1 = 0;
-		tree[leftChildID].padding2 = 0;
-		tree[leftChildID].padding3 = 0;
-		tree[rightChildID].firstQuadPrimitive = quadI;
-		tree[rightChildID].quadPrimitiveCount = node.quadPrimitiveCount - leftQuadCount;
-		tree[rightChildID].firstSpherePrimitive = sphereI;
-		tree[rightChildID].spherePrimitiveCount = node.spherePrimitiveCount - leftSphereCount;
-		tree[rightChildID].padding1 = 0;
-		tree[rightChildID].padding2 = 0;
-		tree[rightChildID].padding3 = 0;
-		node.quadPrimitiveCount = 0;
-		node.spherePrimitiveCount = 0;
-
-		UpdateNodeBounds(leftChildID, quads, spheres, transformBuffer);
-		UpdateNodeBounds(rightChildID, quads, spheres, transformBuffer);
+	// Serial recursive build into nodes, child pairs are allocated from nodeCounter in depth first order
+	void Subdivide(std::vector<BVHNode>& nodes, unsigned int& nodeCounter, const unsigned int nodeID) {
+		BVHNode& node = nodes[nodeID];
+		const unsigned int leftChildID = nodeCounter + 1;
+		const unsigned int rightChildID = nodeCounter + 2;
+		if (!SplitNode(node, nodes[leftChildID], nodes[rightChildID], false)) { return; }
+
+		nodeCounter += 2;
+		node.leftChild = leftChildID;
 
 		// Recursive split
-		Subdivide(leftChildID, quads, spheres, transformBuffer);
-		Subdivide(rightChildID, quads, spheres, transformBuffer);
+		Subdivide(nodes, nodeCounter, leftChildID);
+		Subdivide(nodes, nodeCounter, rightChildID);
 	}
 
-	/*
-	void Subdivide(const unsigned int nodeID, const std::vector<Quad>& quads, const std::vector<Sphere>& spheres) {
-		BVHNode& node = tree[nodeID];
-		if (node.quadPrimitiveCount + node.spherePrimitiveCount <= 2) { return; }
-
-		// Find biggest extent
-		const glm::vec3 extent = node.aabbMax - node.aabbMin;
-		int biggestAxis[3] = { 0, 1, 2 };
-		std::sort(biggestAxis, biggestAxis + 3, [&](int a, int b) { return extent[a] > extent[b]; });
-
-		int quadI;
-		int sphereI;
-		int bestAxis = -1;
-		for (int i = 0; i < 3; i++) {
-			// Test split without swapping
-			const int axis = biggestAxis[i];
-			const float splitPos = node.aabbMin[axis] + extent[axis] * 0.5f;
-
-			// Split node quads
-			quadI = node.firstQuadPrimitive;
-			int quadJ = quadI + node.quadPrimitiveCount - 1;
-			while (quadI <= quadJ) {
-				if (quads[quadIDs[quadI]].GetCentre()[axis] < splitPos) { quadI++; }
-				else { quadJ--; }
-			}
-			// Split node spheres
-			sphereI = node.firstSpherePrimitive;
-			int sphereJ = sphereI + node.spherePrimitiveCount - 1;
-			while (sphereI <= sphereJ) {
-				if (spheres[sphereIDs[sphereI]].Center[axis] < splitPos) { sphereI++; }
-				else { sphereJ--; }
-			}
-
-			// Check if one side of split is empty
-			int leftQuadCount = quadI - node.firstQuadPrimitive;
-			int leftSphereCount = sphereI - node.firstSpherePrimitive;
-			int totalLeftCount = leftQuadCount + leftSphereCount;
-			if (totalLeftCount > 0 && totalLeftCount < node.quadPrimitiveCount + node.spherePrimitiveCount) {
-				// valid split found
-				bestAxis = axis;
-				break;
+	// Parallel build
+	// --------------
+	// Top levels are split one node at a time with binning spread across the thread pool.
+	// Once a node is small enough it becomes a task, tasks are then built as independent subtrees on the pool.
+	// Finally, nodes are numbered exactly as the serial Subdivide would number them so the resulting tree is identical
+	struct BVHBuildTask {
+		BVHNode root;
+		std::vector<BVHNode> nodes;
+		unsigned int nodesUsed = 0;
+		unsigned int globalRootID = 0;
+		unsigned int globalOffset = 0;
+	};
+	struct BVHTopLevelNode {
+		BVHNode node;
+		int leftChild = -1; // rightChild == leftChild + 1
+		int task = -1;
+		unsigned int nodeID = 0;
+	};
+
+	void ParallelSubdivide() {
+		const unsigned int taskThreshold = std::max(MIN_TASK_SIZE, totalElements / (ThreadPool::NumThreads() * TASKS_PER_THREAD));
+
+		BeginTopLevel();
+		SubdivideTopLevel(0, taskThreshold, [this](BVHNode& node, BVHNode& leftChild, BVHNode& rightChild) {
+			return SplitNode(node, leftChild, rightChild, true);
+		});
+
+		RunBuildTasks([this](BVHBuildTask& task) {
+			Subdivide(task.nodes, task.nodesUsed, 0);
+		});
+	}
+
+	// Top level and task storage persists between builds, task node arrays only grow
+	void BeginTopLevel() {
+		topLevel.clear();
+		topLevel.push_back(BVHTopLevelNode());
+		topLevel[0].node = tree[rootNodeID];
+		taskCount = 0;
+	}
+
+	// Builds every task subtree across the pool then copies them into the tree in serial build order
+	void RunBuildTasks(const std::function<void(BVHBuildTask&)>& subdivide) {
+		// Build task subtrees, largest first
+		taskOrder.resize(taskCount);
+		for (unsigned int i = 0; i < taskCount; i++) {
+			taskOrder[i] = i;
+		}
+		std::sort(taskOrder.begin(), taskOrder.end(), [&](const unsigned int a, const unsigned int b) {
+			const BVHNode& rootA = tasks[a].root;
+			const BVHNode& rootB = tasks[b].root;
+			return rootA.primitiveCount > rootB.primitiveCount;
+		});
+		ThreadPool::ParallelFor(taskCount, [&](const unsigned int i) {
+			BVHBuildTask& task = tasks[taskOrder[i]];
+			if (task.nodes.size() < task.root.primitiveCount * 2 + 2) { task.nodes.resize(task.root.primitiveCount * 2 + 2); }
+			task.nodes[0] = task.root;
+			task.nodesUsed = 0;
+			subdivide(task);
+		});
+
+		// Number nodes and copy tasks into the final tree
+		EmitTopLevel(0, rootNodeID);
+		ThreadPool::ParallelFor(taskCount, [&](const unsigned int i) {
+			const BVHBuildTask& task = tasks[i];
+			for (unsigned int localID = 0; localID <= task.nodesUsed; localID++) {
+				BVHNode& node = tree[localID == 0 ? task.globalRootID : task.globalOffset + localID];
+				node = task.nodes[localID];
+				if (node.leftChild != 0) { node.leftChild += task.globalOffset; } // local index 0 is the task root, which is never a child
+			}
+		});
+	}
+
+	void SubdivideTopLevel(const unsigned int topLevelID, const unsigned int taskThreshold, const std::function<bool(BVHNode&, BVHNode&, BVHNode&)>& split) {
+		BVHNode node = topLevel[topLevelID].node;
+		if (node.primitiveCount <= taskThreshold) {
+			topLevel[topLevelID].task = taskCount;
+			if (taskCount == tasks.size()) { tasks.push_back(BVHBuildTask()); }
+			tasks[taskCount++].root = node;
+			return;
+		}
+
+		BVHNode leftChild = BVHNode(), rightChild = BVHNode();
+		const bool didSplit = split(node, leftChild, rightChild);
+		topLevel[topLevelID].node = node;
+		if (!didSplit) { return; }
+
+		const int leftChildID = topLevel.size();
+		topLevel[topLevelID].leftChild = leftChildID;
+		topLevel.push_back(BVHTopLevelNode());
+		topLevel.back().node = leftChild;
+		topLevel.push_back(BVHTopLevelNode());
+		topLevel.back().node = rightChild;
+
+		SubdivideTopLevel(leftChildID, taskThreshold, split);
+		SubdivideTopLevel(leftChildID + 1, taskThreshold, split);
+	}
+
+	void EmitTopLevel(const unsigned int topLevelID, const unsigned int nodeID) {
+		BVHTopLevelNode& topLevelNode = topLevel[topLevelID];
+		topLevelNode.nodeID = nodeID;
+		if (topLevelNode.task >= 0) {
+			// Task subtree occupies the next task.nodesUsed slots, copied later
+			BVHBuildTask& task = tasks[topLevelNode.task];
+			task.globalRootID = nodeID;
+			task.globalOffset = nodesUsed;
+			nodesUsed += task.nodesUsed;
+			return;
+		}
+
+		tree[nodeID] = topLevelNode.node;
+		if (topLevelNode.leftChild < 0) { return; }
+
+		const unsigned int leftChildID = ++nodesUsed;
+		const unsigned int rightChildID = ++nodesUsed;
+		tree[nodeID].leftChild = leftChildID;
+		EmitTopLevel(topLevelNode.leftChild, leftChildID);
+		EmitTopLevel(topLevelNode.leftChild + 1, rightChildID);
+	}
+
+	// Linear BVH
+	// ----------
+	// Primitives are sorted along a Morton curve and the hierarchy is emitted from the sorted order without any SAH evaluation
+	void BuildLBVH() {
+		SortByMortonCode();
+
+		// Emit hierarchy
+		const unsigned int count = totalElements;
+		if (count >= PARALLEL_BUILD_THRESHOLD && ThreadPool::NumThreads() > 1) {
+			const unsigned int taskThreshold = std::max(MIN_TASK_SIZE, totalElements / (ThreadPool::NumThreads() * TASKS_PER_THREAD));
+
+			BeginTopLevel();
+			SubdivideTopLevel(0, taskThreshold, [this](BVHNode& node, BVHNode& leftChild, BVHNode& rightChild) {
+				return SplitNodeLBVH(node, leftChild, rightChild);
+			});
+
+			RunBuildTasks([this](BVHBuildTask& task) {
+				SubdivideLBVH(task.nodes, task.nodesUsed, 0);
+			});
+
+			// Top level bounds from their children, a child always comes after its parent in topLevel
+			for (int i = topLevel.size() - 1; i >= 0; i--) {
+				if (topLevel[i].leftChild < 0) { continue; }
+				BVHNode& node = tree[topLevel[i].nodeID];
+				node.bbox = tree[topLevel[topLevel[i].leftChild].nodeID].bbox;
+				node.bbox.grow(tree[topLevel[topLevel[i].leftChild + 1].nodeID].bbox);
 			}
 		}
-		// If no axis found, return. Node cannot be split
-		if (bestAxis == -1) { return; }
+		else {
+			SubdivideLBVH(tree, nodesUsed, rootNodeID);
+		}
+	}
+
+	// Sorts primitive references and the primitive cache along a Morton curve, leaving mortonCodes in sorted order
+	void SortByMortonCode() {
+		const unsigned int count = totalElements;
+		const unsigned int chunkSize = std::max(PARALLEL_CHUNK_SIZE, (count + ThreadPool::NumThreads() - 1) / ThreadPool::NumThreads());
+		const unsigned int numChunks = (count + chunkSize - 1) / chunkSize;
+
+		// Centroid bounds of every primitive
+		glm::vec3 centroidMin = glm::vec3(1e30f), centroidMax = glm::vec3(-1e30f);
+		std::mutex mergeMutex;
+		ThreadPool::ParallelForRange(count, PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			glm::vec3 chunkMin = glm::vec3(1e30f), chunkMax = glm::vec3(-1e30f);
+			GetCentroidBounds(tree[rootNodeID], begin, end, chunkMin, chunkMax);
+			std::lock_guard<std::mutex> lock(mergeMutex);
+			centroidMin = glm::min(centroidMin, chunkMin);
+			centroidMax = glm::max(centroidMax, chunkMax);
+		});
+
+		// Morton codes
+		const unsigned int mortonMax = (1u << MORTON_BITS) - 1u;
+		glm::vec3 scale;
+		for (int a = 0; a < 3; a++) {
+			const float extent = centroidMax[a] - centroidMin[a];
+			scale[a] = extent > 0.0f ? mortonMax / extent : 0.0f;
+		}
+		mortonCodes.resize(count);
+		sortedPrimitives.resize(count);
+		ThreadPool::ParallelForRange(count, PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				unsigned int code = 0;
+				for (int a = 0; a < 3; a++) {
+					const unsigned int cell = std::min(mortonMax, (unsigned int)((primitiveCache.centre[a][i] - centroidMin[a]) * scale[a]));
+					code |= ExpandBits(cell) << (2 - a);
+				}
+				mortonCodes[i] = code;
+				sortedPrimitives[i] = i;
+			}
+		});
+		RadixSortMortonCodes(chunkSize, numChunks);
+
+		// References are still the identity here so cache index and primitive reference index match
+		sortedCache.Resize(count);
+		sortedReferences.resize(count);
+		ThreadPool::ParallelForRange(count, PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				sortedReferences[i] = primitiveRefs[sortedPrimitives[i]];
+				sortedCache.Copy(primitiveCache, sortedPrimitives[i], i);
+			}
+		});
+		primitiveRefs.swap(sortedReferences);
+		std::swap(primitiveCache, sortedCache);
+	}
+
+	// Spreads the low 10 bits of v out so there are two zero bits between each
+	static unsigned int ExpandBits(unsigned int v) {
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
 
-		const float splitPos = node.aabbMin[bestAxis] + extent[bestAxis] * 0.5f;
+	// Stable least significant digit radix sort of mortonCodes, carrying sortedPrimitives with them
+	void RadixSortMortonCodes(const unsigned int chunkSize, const unsigned int numChunks) {
+		const unsigned int count = mortonCodes.size();
+		const unsigned int radix = 1u << RADIX_BITS;
+		mortonCodesScratch.resize(count);
+		sortedPrimitivesScratch.resize(count);
+		radixOffsets.resize(numChunks * radix);
+		std::vector<unsigned int>& offsets = radixOffsets;
+
+		for (unsigned int shift = 0; shift < MORTON_BITS * 3; shift += RADIX_BITS) {
+			// Digit histogram per chunk
+			std::fill(offsets.begin(), offsets.end(), 0u);
+			ThreadPool::ParallelFor(numChunks, [&](const unsigned int chunk) {
+				unsigned int* histogram = &offsets[chunk * radix];
+				const unsigned int end = std::min(count, (chunk + 1) * chunkSize);
+				for (unsigned int i = chunk * chunkSize; i < end; i++) {
+					histogram[(mortonCodes[i] >> shift) & (radix - 1)]++;
+				}
+			});
+
+			// Exclusive scan in digit then chunk order keeps the scatter stable
+			unsigned int sum = 0;
+			for (unsigned int digit = 0; digit < radix; digit++) {
+				for (unsigned int chunk = 0; chunk < numChunks; chunk++) {
+					const unsigned int digitCount = offsets[chunk * radix + digit];
+					offsets[chunk * radix + digit] = sum;
+					sum += digitCount;
+				}
+			}
+
+			ThreadPool::ParallelFor(numChunks, [&](const unsigned int chunk) {
+				unsigned int* offset = &offsets[chunk * radix];
+				const unsigned int end = std::min(count, (chunk + 1) * chunkSize);
+				for (unsigned int i = chunk * chunkSize; i < end; i++) {
+					const unsigned int destination = offset[(mortonCodes[i] >> shift) & (radix - 1)]++;
+					mortonCodesScratch[destination] = mortonCodes[i];
+					sortedPrimitivesScratch[destination] = sortedPrimitives[i];
+				}
+			});
+			mortonCodes.swap(mortonCodesScratch);
+			sortedPrimitives.swap(sortedPrimitivesScratch);
+		}
+	}
 
-		// Split node quads
-		quadI = node.firstQuadPrimitive;
-		int quadJ = quadI + node.quadPrimitiveCount - 1;
-		while (quadI <= quadJ) {
-			if (quads[quadIDs[quadI]].GetCentre()[bestAxis] < splitPos) { quadI++; }
-			else { std::swap(quadIDs[quadI], quadIDs[quadJ--]); }
+	// Splits at the highest Morton bit that differs across the node, or at the middle if every code is equal
+	bool SplitNodeLBVH(BVHNode& node, BVHNode& leftChild, BVHNode& rightChild) const {
+		const unsigned int primitiveCount = node.primitiveCount;
+		if (primitiveCount <= buildSettings.maxLeafSize) { return false; }
+
+		const unsigned int begin = node.firstPrimitive;
+		const unsigned int end = begin + primitiveCount;
+		const unsigned int firstCode = mortonCodes[begin];
+		unsigned int highestBit = firstCode ^ mortonCodes[end - 1];
+		unsigned int split;
+		if (highestBit == 0) {
+			split = begin + primitiveCount / 2;
 		}
-		// Split node spheres
-		sphereI = node.firstSpherePrimitive;
-		int sphereJ = sphereI + node.spherePrimitiveCount - 1;
-		while (sphereI <= sphereJ) {
-			if (spheres[sphereIDs[sphereI]].Center[bestAxis] < splitPos) { sphereI++; }
-			else { std::swap(sphereIDs[sphereI], sphereIDs[sphereJ--]); }
+		else {
+			highestBit |= highestBit >> 1;
+			highestBit |= highestBit >> 2;
+			highestBit |= highestBit >> 4;
+			highestBit |= highestBit >> 8;
+			highestBit |= highestBit >> 16;
+			highestBit = (highestBit >> 1) + 1;
+
+			// Codes are sorted, so those sharing the first code's prefix down to highestBit all come before the split
+			split = std::partition_point(mortonCodes.begin() + begin, mortonCodes.begin() + end, [&](const unsigned int code) {
+				return (firstCode ^ code) < highestBit;
+			}) - mortonCodes.begin();
 		}
 
-		int leftQuadCount = quadI - node.firstQuadPrimitive;
-		int leftSphereCount = sphereI - node.firstSpherePrimitive;
+		SetLBVHRange(leftChild, begin, split);
+		SetLBVHRange(rightChild, split, end);
+		node.primitiveCount = 0;
+		return true;
+	}
+
+	// Resets node to a leaf over sorted positions [begin, end)
+	static void SetLBVHRange(BVHNode& node, const unsigned int begin, const unsigned int end) {
+		node = BVHNode();
+		node.firstPrimitive = begin;
+		node.primitiveCount = end - begin;
+		node.padding = 0;
+	}
 
-		// Create child nodes
-		int leftChildID = ++nodesUsed;
-		int rightChildID = ++nodesUsed;
+	// Same node numbering as Subdivide, but bounds are built bottom up so each primitive is only read once
+	void SubdivideLBVH(std::vector<BVHNode>& nodes, unsigned int& nodeCounter, const unsigned int nodeID) {
+		BVHNode& node = nodes[nodeID];
+		const unsigned int leftChildID = nodeCounter + 1;
+		const unsigned int rightChildID = nodeCounter + 2;
+		if (!SplitNodeLBVH(node, nodes[leftChildID], nodes[rightChildID])) {
+			UpdateNodeBounds(node);
+			return;
+		}
+
+		nodeCounter += 2;
 		node.leftChild = leftChildID;
 
-		tree[leftChildID].firstQuadPrimitive = node.firstQuadPrimitive;
-		tree[leftChildID].quadPrimitiveCount = leftQuadCount;
-		tree[leftChildID].firstSpherePrimitive = node.firstSpherePrimitive;
-		tree[leftChildID].spherePrimitiveCount = leftSphereCount;
-		tree[leftChildID].padding1 = 0;
-		tree[leftChildID].padding2 = 0;
-		tree[leftChildID].padding3 = 0;
-		tree[rightChildID].firstQuadPrimitive = quadI;
-		tree[rightChildID].quadPrimitiveCount = node.quadPrimitiveCount - leftQuadCount;
-		tree[rightChildID].firstSpherePrimitive = sphereI;
-		tree[rightChildID].spherePrimitiveCount = node.spherePrimitiveCount - leftSphereCount;
-		tree[rightChildID].padding1 = 0;
-		tree[rightChildID].padding2 = 0;
-		tree[rightChildID].padding3 = 0;
-		node.quadPrimitiveCount = 0;
-		node.spherePrimitiveCount = 0;
-
-		UpdateNodeBounds(leftChildID, quads, spheres);
-		UpdateNodeBounds(rightChildID, quads, spheres);
+		SubdivideLBVH(nodes, nodeCounter, leftChildID);
+		SubdivideLBVH(nodes, nodeCounter, rightChildID);
+		node.bbox = nodes[leftChildID].bbox;
+		node.bbox.grow(nodes[rightChildID].bbox);
+	}
 
-		// Recursive split
-		Subdivide(leftChildID, quads, spheres);
-		Subdivide(rightChildID, quads, spheres);
+	// PLOC
+	// ----
+	// Parallel locally ordered clustering. Every Morton sorted primitive starts as a cluster, each pass merges clusters that are
+	// each other's nearest neighbour within PLOC_SEARCH_RADIUS positions until one is left.
+	// Subtrees are collapsed into leaves where SAH prefers it, then emitted in the same depth first layout as the other builders
+	struct BVHClusterNode {
+		aabb bbox;
+		unsigned int leftChild, rightChild;	// Nodes below the primitive count are primitives at that sorted position
+		unsigned int primitiveCount;
+		float cost;		// SAH cost of the subtree, unnormalised
+		bool collapse;	// Emitted as a single leaf
+	};
+
+	// Cluster bounds packed without aabb's padding, the neighbour search reads a lot of them
+	struct BVHClusterBounds {
+		glm::vec3 boundsMin, boundsMax;
+	};
+
+	void BuildPLOC() {
+		SortByMortonCode();
+
+		// Every primitive starts as its own cluster
+		const unsigned int count = totalElements;
+		clusterNodes.resize(count * 2 - 1);
+		clusters.resize(count);
+		clustersScratch.resize(count);
+		clusterBounds.resize(count);
+		clusterBoundsScratch.resize(count);
+		neighbours.resize(count);
+		ThreadPool::ParallelForRange(count, PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				BVHClusterNode& node = clusterNodes[i];
+				node.bbox = aabb();
+				GrowBounds(node.bbox, i, i + 1);
+				node.leftChild = node.rightChild = 0;
+				node.primitiveCount = 1;
+				node.cost = node.bbox.area();
+				node.collapse = true;
+				clusters[i] = i;
+				clusterBounds[i] = { glm::vec3(node.bbox.aabbMin), glm::vec3(node.bbox.aabbMax) };
+			}
+		});
+
+		unsigned int clusterCount = count;
+		std::atomic<unsigned int> nextNode(count);
+		while (clusterCount > 1) {
+			const unsigned int chunkSize = std::max(PARALLEL_CHUNK_SIZE, (clusterCount + ThreadPool::NumThreads() - 1) / ThreadPool::NumThreads());
+			const unsigned int numChunks = (clusterCount + chunkSize - 1) / chunkSize;
+			clusterChunkCounts.resize(numChunks);
+
+			// Nearest neighbour by the area of the union. Scanning upwards and only taking strictly smaller areas breaks ties towards
+			// the lowest pair, so the closest pair overall is always mutual and every pass merges at least once
+			ThreadPool::ParallelFor(numChunks, [&](const unsigned int chunk) {
+				const unsigned int end = std::min(clusterCount, (chunk + 1) * chunkSize);
+				for (unsigned int i = chunk * chunkSize; i < end; i++) {
+					const BVHClusterBounds bounds = clusterBounds[i];
+					const unsigned int first = (i > PLOC_SEARCH_RADIUS) ? i - PLOC_SEARCH_RADIUS : 0;
+					const unsigned int last = std::min(clusterCount - 1, i + PLOC_SEARCH_RADIUS);
+					float bestArea = 1e30f;
+					unsigned int best = i;
+					for (unsigned int j = first; j <= last; j++) {
+						if (j == i) { continue; }
+						const float area = UnionArea(bounds, clusterBounds[j]);
+						if (area < bestArea) {
+							bestArea = area;
+							best = j;
+						}
+					}
+					neighbours[i] = best;
+				}
+			});
+
+			// Merge mutual neighbours into the lower position
+			ThreadPool::ParallelFor(numChunks, [&](const unsigned int chunk) {
+				const unsigned int end = std::min(clusterCount, (chunk + 1) * chunkSize);
+				unsigned int survivors = 0;
+				for (unsigned int i = chunk * chunkSize; i < end; i++) {
+					const unsigned int neighbour = neighbours[i];
+					if (neighbours[neighbour] != i) {
+						clustersScratch[i] = clusters[i];
+						clusterBoundsScratch[i] = clusterBounds[i];
+					}
+					else if (i < neighbour) {
+						const unsigned int nodeID = nextNode.fetch_add(1, std::memory_order_relaxed);
+						MergeClusters(clusterNodes[nodeID], clusters[i], clusters[neighbour]);
+						clustersScratch[i] = nodeID;
+						clusterBoundsScratch[i] = { glm::vec3(clusterNodes[nodeID].bbox.aabbMin), glm::vec3(clusterNodes[nodeID].bbox.aabbMax) };
+					}
+					else {
+						clustersScratch[i] = PLOC_MERGED;
+						continue;
+					}
+					survivors++;
+				}
+				clusterChunkCounts[chunk] = survivors;
+			});
+
+			// Compact surviving clusters, keeping their order
+			unsigned int sum = 0;
+			for (unsigned int chunk = 0; chunk < numChunks; chunk++) {
+				const unsigned int survivors = clusterChunkCounts[chunk];
+				clusterChunkCounts[chunk] = sum;
+				sum += survivors;
+			}
+			ThreadPool::ParallelFor(numChunks, [&](const unsigned int chunk) {
+				const unsigned int end = std::min(clusterCount, (chunk + 1) * chunkSize);
+				unsigned int offset = clusterChunkCounts[chunk];
+				for (unsigned int i = chunk * chunkSize; i < end; i++) {
+					if (clustersScratch[i] == PLOC_MERGED) { continue; }
+					clusters[offset] = clustersScratch[i];
+					clusterBounds[offset++] = clusterBoundsScratch[i];
+				}
+			});
+			clusterCount = sum;
+		}
+
+		EmitClusters(clusters[0]);
+	}
+
+	static float UnionArea(const BVHClusterBounds& a, const BVHClusterBounds& b) {
+		const glm::vec3 e = glm::max(a.boundsMax, b.boundsMax) - glm::min(a.boundsMin, b.boundsMin);
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	// Either keeps both clusters as children or collapses them into one leaf, whichever SAH prefers
+	void MergeClusters(BVHClusterNode& node, const unsigned int leftID, const unsigned int rightID) const {
+		const BVHClusterNode& left = clusterNodes[leftID];
+		const BVHClusterNode& right = clusterNodes[rightID];
+		node.bbox = left.bbox;
+		node.bbox.grow(right.bbox);
+		node.leftChild = leftID;
+		node.rightChild = rightID;
+		node.primitiveCount = left.primitiveCount + right.primitiveCount;
+
+		const float area = node.bbox.area();
+		const float splitCost = buildSettings.traversalCost * area + left.cost + right.cost;
+		const float leafCost = node.primitiveCount * area;
+		node.collapse = node.primitiveCount <= buildSettings.maxLeafSize && leafCost <= splitCost;
+		node.cost = node.collapse ? leafCost : splitCost;
+	}
+
+	// Writes the cluster tree into the tree in depth first order, reordering references so each leaf's primitives are contiguous
+	void EmitClusters(const unsigned int rootCluster) {
+		const unsigned int count = totalElements;
+		sortedCache.Resize(count);
+		sortedReferences.resize(count);
+		unsigned int nextPrimitive = 0;
+
+		clusterStack.clear();
+		clusterStack.push_back(std::make_pair(rootCluster, rootNodeID));
+		while (!clusterStack.empty()) {
+			const unsigned int clusterID = clusterStack.back().first;
+			const unsigned int nodeID = clusterStack.back().second;
+			clusterStack.pop_back();
+			const BVHClusterNode& cluster = clusterNodes[clusterID];
+			BVHNode& node = tree[nodeID];
+			node = BVHNode();
+			node.bbox = cluster.bbox;
+			if (!cluster.collapse) {
+				node.leftChild = nodesUsed + 1;
+				nodesUsed += 2;
+				clusterStack.push_back(std::make_pair(cluster.rightChild, node.leftChild + 1));
+				clusterStack.push_back(std::make_pair(cluster.leftChild, node.leftChild));
+				continue;
+			}
+
+			// Gather the collapsed subtree's primitives in order
+			node.firstPrimitive = nextPrimitive;
+			node.primitiveCount = cluster.primitiveCount;
+			clusterGatherStack.clear();
+			clusterGatherStack.push_back(clusterID);
+			while (!clusterGatherStack.empty()) {
+				const unsigned int gatherID = clusterGatherStack.back();
+				clusterGatherStack.pop_back();
+				if (gatherID < count) {
+					sortedReferences[nextPrimitive] = primitiveRefs[gatherID];
+					sortedCache.Copy(primitiveCache, gatherID, nextPrimitive++);
+					continue;
+				}
+				clusterGatherStack.push_back(clusterNodes[gatherID].rightChild);
+				clusterGatherStack.push_back(clusterNodes[gatherID].leftChild);
+			}
+		}
+		primitiveRefs.swap(sortedReferences);
+		std::swap(primitiveCache, sortedCache);
+	}
+
+	// Spatial split BVH
+	// -----------------
+	// Binned SAH over primitive references, where a reference straddling a spatial split plane is clipped and duplicated into both children
+	void BuildSBVH(const std::vector<Quad>& quads, const std::vector<Sphere>& spheres, const std::vector<glm::mat4>& transformBuffer) {
+		// World space outline of each quad, used to clip references
+		sbvhVertices.resize(quads.size() * 4);
+		ThreadPool::ParallelForRange(quads.size(), PARALLEL_CHUNK_SIZE, [&](const unsigned int begin, const unsigned int end) {
+			for (unsigned int i = begin; i < end; i++) {
+				BVHPrimitiveCache::GetQuadOutline(quads[i], transformBuffer[quads[i].Normal.a], &sbvhVertices[i * 4]);
+			}
+		});
+
+		std::vector<BVHReference> references(totalElements);
+		for (unsigned int i = 0; i < totalElements; i++) {
+			for (int a = 0; a < 3; a++) {
+				references[i].bounds.aabbMin[a] = primitiveCache.boundsMin[a][i];
+				references[i].bounds.aabbMax[a] = primitiveCache.boundsMax[a][i];
+			}
+			references[i].primitive = primitiveRefs[i];
+		}
+
+		const unsigned int referenceLimit = totalElements + (unsigned int)(totalElements * spatialSplitBudget);
+		spatialSplitsLeft = referenceLimit - totalElements;
+		tree.resize(referenceLimit * 2 + 2);
+
+		UpdateNodeBounds(tree[rootNodeID]);
+		sbvhRootArea = tree[rootNodeID].bbox.area();
+		primitiveRefs.clear();
+		primitiveRefs.reserve(referenceLimit);
+		SubdivideSBVH(references, rootNodeID, 0);
+
+		// Cache follows the final reference order, duplicates included
+		primitiveCache.Build(quads, spheres, transformBuffer, primitiveRefs);
+	}
+
+	struct BVHReference {
+		aabb bounds; // may be clipped to part of the primitive
+		unsigned int primitive; // BVHPrimitiveRef
+	};
+	struct SBVHSplit {
+		float cost = 1e30f;
+		int axis = -1;
+		float position = 0.0f;
+		bool spatial = false;
+		aabb leftBounds, rightBounds;
+		unsigned int leftCount = 0, rightCount = 0;
+	};
+
+	void SubdivideSBVH(std::vector<BVHReference>& references, const unsigned int nodeID, const unsigned int depth) {
+		BVHNode& node = tree[nodeID];
+		node = BVHNode();
+		for (const BVHReference& reference : references) {
+			node.bbox.grow(reference.bounds);
+		}
+		if (references.size() <= 1 || depth >= MAX_TREE_DEPTH) {
+			MakeLeafSBVH(node, references);
+			return;
+		}
+
+		SBVHSplit split = FindObjectSplitSBVH(references);
+
+		// Only look for a spatial split where object split children overlap noticeably
+		aabb overlap;
+		overlap.aabbMin = glm::max(split.leftBounds.aabbMin, split.rightBounds.aabbMin);
+		overlap.aabbMax = glm::min(split.leftBounds.aabbMax, split.rightBounds.aabbMax);
+		const bool overlapping = split.axis >= 0 && glm::all(glm::lessThan(glm::vec3(overlap.aabbMin), glm::vec3(overlap.aabbMax)));
+		if (spatialSplitsLeft > 0 && (split.axis < 0 || (overlapping && overlap.area() > SBVH_OVERLAP_THRESHOLD * sbvhRootArea))) {
+			const SBVHSplit spatialSplit = FindSpatialSplitSBVH(references, node.bbox);
+			if (spatialSplit.cost < split.cost) { split = spatialSplit; }
+		}
+
+		// Further splits will be detrimental
+		const float splitCost = split.cost + buildSettings.traversalCost * node.bbox.area();
+		if (split.axis < 0 || (splitCost >= references.size() * node.bbox.area() && references.size() <= buildSettings.maxLeafSize)) {
+			MakeLeafSBVH(node, references);
+			return;
+		}
+
+		std::vector<BVHReference> left, right;
+		if (split.spatial) { PartitionSpatialSBVH(references, split, left, right); }
+		else {
+			for (const BVHReference& reference : references) {
+				const float centre = (reference.bounds.aabbMin[split.axis] + reference.bounds.aabbMax[split.axis]) * 0.5f;
+				if (centre < split.position) { left.push_back(reference); }
+				else { right.push_back(reference); }
+			}
+		}
+		if (left.empty() || right.empty()) {
+			MakeLeafSBVH(node, references);
+			return;
+		}
+
+		// Release parent references before going deeper
+		std::vector<BVHReference>().swap(references);
+
+		const unsigned int leftChildID = ++nodesUsed;
+		const unsigned int rightChildID = ++nodesUsed;
+		node.leftChild = leftChildID;
+		node.primitiveCount = 0;
+		SubdivideSBVH(left, leftChildID, depth + 1);
+		SubdivideSBVH(right, rightChildID, depth + 1);
+	}
+
+	void MakeLeafSBVH(BVHNode& node, const std::vector<BVHReference>& references) {
+		node.firstPrimitive = primitiveRefs.size();
+		node.primitiveCount = references.size();
+		for (const BVHReference& reference : references) {
+			primitiveRefs.push_back(reference.primitive);
+		}
+	}
+
+	SBVHSplit FindObjectSplitSBVH(const std::vector<BVHReference>& references) const {
+		glm::vec3 centroidMin = glm::vec3(1e30f), centroidMax = glm::vec3(-1e30f);
+		for (const BVHReference& reference : references) {
+			const glm::vec3 centre = glm::vec3(reference.bounds.aabbMin + reference.bounds.aabbMax) * 0.5f;
+			centroidMin = glm::min(centroidMin, centre);
+			centroidMax = glm::max(centroidMax, centre);
+		}
+
+		SBVHSplit best;
+		for (int a = 0; a < 3; a++) {
+			const float boundsMin = centroidMin[a], boundsMax = centroidMax[a];
+			if (boundsMin == boundsMax) { continue; }
+
+			const int binCount = buildSettings.binCount;
+			aabb bins[MAX_BINS];
+			unsigned int counts[MAX_BINS] = {};
+			const float scale = binCount / (boundsMax - boundsMin);
+			for (const BVHReference& reference : references) {
+				const float centre = (reference.bounds.aabbMin[a] + reference.bounds.aabbMax[a]) * 0.5f;
+				const int binID = std::min(binCount - 1, (int)((centre - boundsMin) * scale));
+				bins[binID].grow(reference.bounds);
+				counts[binID]++;
+			}
+
+			const float binWidth = (boundsMax - boundsMin) / binCount;
+			EvaluateSplitsSBVH(bins, counts, counts, binCount, a, boundsMin, binWidth, false, best);
+		}
+		return best;
+	}
+
+	SBVHSplit FindSpatialSplitSBVH(const std::vector<BVHReference>& references, const aabb& nodeBounds) {
+		SBVHSplit best;
+		for (int a = 0; a < 3; a++) {
+			const float boundsMin = nodeBounds.aabbMin[a], boundsMax = nodeBounds.aabbMax[a];
+			if (boundsMin >= boundsMax) { continue; }
+
+			aabb bins[SBVH_SPATIAL_BINS];
+			unsigned int entries[SBVH_SPATIAL_BINS] = {}, exits[SBVH_SPATIAL_BINS] = {};
+			const float scale = SBVH_SPATIAL_BINS / (boundsMax - boundsMin);
+			const float binWidth = (boundsMax - boundsMin) / SBVH_SPATIAL_BINS;
+			auto binOf = [&](const float position) { return std::max(0, std::min(SBVH_SPATIAL_BINS - 1, (int)((position - boundsMin) * scale))); };
+
+			for (const BVHReference& reference : references) {
+				// Spheres are never split, duplicating a constant medium would sample it twice
+				if (BVHPrimitiveRef::Type(reference.primitive) != BVH_PRIMITIVE_QUAD) {
+					const int binID = binOf((reference.bounds.aabbMin[a] + reference.bounds.aabbMax[a]) * 0.5f);
+					bins[binID].grow(reference.bounds);
+					entries[binID]++;
+					exits[binID]++;
+					continue;
+				}
+
+				// Chop the reference into each bin it covers
+				const int firstBin = binOf(reference.bounds.aabbMin[a]);
+				const int lastBin = binOf(reference.bounds.aabbMax[a]);
+				BVHReference remaining = reference;
+				for (int binID = firstBin; binID < lastBin; binID++) {
+					BVHReference leftPart, rightPart;
+					SplitReferenceSBVH(remaining, a, boundsMin + binWidth * (binID + 1), leftPart, rightPart);
+					bins[binID].grow(leftPart.bounds);
+					remaining = rightPart;
+				}
+				bins[lastBin].grow(remaining.bounds);
+				entries[firstBin]++;
+				exits[lastBin]++;
+			}
+
+			EvaluateSplitsSBVH(bins, entries, exits, SBVH_SPATIAL_BINS, a, boundsMin, binWidth, true, best);
+		}
+
+		// Spatial splits that would go over the duplication budget are not an option
+		if (best.axis >= 0 && (int)(best.leftCount + best.rightCount - references.size()) > spatialSplitsLeft) { return SBVHSplit(); }
+		return best;
+	}
+
+	// Sweeps the planes between bins, leftCounts are the references starting in a bin and rightCounts those ending in it
+	template <int maxBins>
+	static void EvaluateSplitsSBVH(const aabb (&bins)[maxBins], const unsigned int (&leftCounts)[maxBins], const unsigned int (&rightCounts)[maxBins], const int binCount, const int axis, const float boundsMin, const float binWidth, const bool spatial, SBVHSplit& best) {
+		aabb rightBounds[maxBins];
+		unsigned int rightSums[maxBins];
+		aabb rightBox;
+		unsigned int rightSum = 0;
+		for (int i = binCount - 1; i > 0; i--) {
+			rightBox.grow(bins[i]);
+			rightSum += rightCounts[i];
+			rightBounds[i] = rightBox;
+			rightSums[i] = rightSum;
+		}
+
+		aabb leftBox;
+		unsigned int leftSum = 0;
+		for (int i = 0; i < binCount - 1; i++) {
+			leftBox.grow(bins[i]);
+			leftSum += leftCounts[i];
+			if (leftSum == 0 || rightSums[i + 1] == 0) { continue; }
+
+			const float planeCost = leftSum * leftBox.area() + rightSums[i + 1] * rightBounds[i + 1].area();
+			if (planeCost < best.cost) {
+				best.cost = planeCost;
+				best.axis = axis;
+				best.position = boundsMin + binWidth * (i + 1);
+				best.spatial = spatial;
+				best.leftBounds = leftBox;
+				best.rightBounds = rightBounds[i + 1];
+				best.leftCount = leftSum;
+				best.rightCount = rightSums[i + 1];
+			}
+		}
+	}
+
+	void PartitionSpatialSBVH(const std::vector<BVHReference>& references, const SBVHSplit& split, std::vector<BVHReference>& left, std::vector<BVHReference>& right) {
+		const int axis = split.axis;
+		aabb leftBounds = split.leftBounds, rightBounds = split.rightBounds;
+		unsigned int leftCount = split.leftCount, rightCount = split.rightCount;
+		for (const BVHReference& reference : references) {
+			if (BVHPrimitiveRef::Type(reference.primitive) != BVH_PRIMITIVE_QUAD) {
+				if ((reference.bounds.aabbMin[axis] + reference.bounds.aabbMax[axis]) * 0.5f < split.position) { left.push_back(reference); }
+				else { right.push_back(reference); }
+			}
+			else if (reference.bounds.aabbMax[axis] <= split.position) { left.push_back(reference); }
+			else if (reference.bounds.aabbMin[axis] >= split.position) { right.push_back(reference); }
+			else {
+				// Keep the reference whole on one side when that is cheaper than duplicating it
+				aabb leftUnion = leftBounds, rightUnion = rightBounds;
+				leftUnion.grow(reference.bounds);
+				rightUnion.grow(reference.bounds);
+				const float splitCost = leftBounds.area() * leftCount + rightBounds.area() * rightCount;
+				const float leftCost = leftUnion.area() * leftCount + rightBounds.area() * (rightCount - 1);
+				const float rightCost = leftBounds.area() * (leftCount - 1) + rightUnion.area() * rightCount;
+				if (leftCost < splitCost && leftCost <= rightCost) {
+					left.push_back(reference);
+					leftBounds = leftUnion;
+					rightCount--;
+				}
+				else if (rightCost < splitCost) {
+					right.push_back(reference);
+					rightBounds = rightUnion;
+					leftCount--;
+				}
+				else {
+					BVHReference leftPart, rightPart;
+					SplitReferenceSBVH(reference, axis, split.position, leftPart, rightPart);
+					const bool leftValid = leftPart.bounds.aabbMin.x != 1e30f, rightValid = rightPart.bounds.aabbMin.x != 1e30f;
+					if (leftValid) { left.push_back(leftPart); }
+					if (rightValid) { right.push_back(rightPart); }
+					if (leftValid && rightValid) { spatialSplitsLeft--; }
+				}
+			}
+		}
+	}
+
+	// Clips a quad reference against the plane at position on axis, both parts stay inside the reference's current bounds
+	void SplitReferenceSBVH(const BVHReference& reference, const int axis, const float position, BVHReference& left, BVHReference& right) const {
+		left.primitive = reference.primitive;
+		right.primitive = reference.primitive;
+		left.bounds = aabb();
+		right.bounds = aabb();
+
+		const glm::vec3* vertices = &sbvhVertices[BVHPrimitiveRef::Index(reference.primitive) * 4];
+		for (int i = 0; i < 4; i++) {
+			const glm::vec3& v0 = vertices[i];
+			const glm::vec3& v1 = vertices[(i + 1) % 4];
+			if (v0[axis] <= position) { left.bounds.grow(v0); }
+			if (v0[axis] >= position) { right.bounds.grow(v0); }
+			if ((v0[axis] < position && v1[axis] > position) || (v0[axis] > position && v1[axis] < position)) {
+				glm::vec3 intersection = glm::mix(v0, v1, (position - v0[axis]) / (v1[axis] - v0[axis]));
+				intersection[axis] = position;
+				left.bounds.grow(intersection);
+				right.bounds.grow(intersection);
+			}
+		}
+
+		left.bounds.aabbMax[axis] = std::min(left.bounds.aabbMax[axis], position);
+		right.bounds.aabbMin[axis] = std::max(right.bounds.aabbMin[axis], position);
+		ClipBoundsSBVH(left.bounds, reference.bounds);
+		ClipBoundsSBVH(right.bounds, reference.bounds);
+	}
+
+	// Intersects bounds with clip, leaving it empty if nothing remains
+	static void ClipBoundsSBVH(aabb& bounds, const aabb& clip) {
+		if (bounds.aabbMin.x == 1e30f) { return; }
+		bounds.aabbMin = glm::max(bounds.aabbMin, clip.aabbMin);
+		bounds.aabbMax = glm::min(bounds.aabbMax, clip.aabbMax);
+		if (glm::any(glm::greaterThan(glm::vec3(bounds.aabbMin), glm::vec3(bounds.aabbMax)))) { bounds = aabb(); }
 	}
-	*/
 
 	unsigned int rootNodeID, nodesUsed, totalElements;
 	std::vector<BVHNode> tree;
-
-	std::vector<unsigned int> quadIDs, sphereIDs;
+	std::vector<BVHWideNode> wideTree;
+	std::vector<BVHCompressedNode> compressedTree;
+
+	std::vector<unsigned int> primitiveRefs; // BVHPrimitiveRef per leaf entry, each leaf's range is sorted by type
+	mutable std::vector<unsigned int> leafOrderRefs; // Uploaded in place of primitiveRefs when reorderPrimitives is set, kept to reuse its allocation
+	BVHPrimitiveCache primitiveCache;
+	BVHPrimitiveSources primitiveSources;
+
+	BVHBuildMethod buildMethod;
+	BVHBuildSettings buildSettings;
+	BVHBuildQuality buildQuality;
+	BVHOptimisationStats optimisationStats;
+
+	// Refit policy
+	unsigned int builtQuadCount, builtSphereCount;
+	float builtSAHCost;
+	float buildMilliseconds;	// Last build or cache load
+	bool loadedFromCache;
+	float rebuildThreshold;
+	unsigned int maxRebuildLatency;
+	unsigned int rebuildGeneration;	// Bumped whenever the tree is replaced or edited
+	std::shared_ptr<BVHRebuildJob> rebuildJob;
+
+	// Tooling results for the current tree, dropped by any build, refit or edit
+	mutable BVHStats stats;
+	mutable BVHValidation validation;
+	mutable bool statsCurrent;
+	mutable bool validationCurrent;
+
+	// Incremental editing
+	bool editsPending;		// Tree changed since the last UpdateBVH
+	bool depthFirstOrder;	// Children have a higher index than their parent
+	bool parentsValid;
+	std::vector<unsigned int> parents;
+	std::vector<unsigned int> freePairs;
+
+	// Build storage, kept between builds so per frame rebuilds don't reallocate once warmed up
+	std::vector<BVHTopLevelNode> topLevel;
+	std::vector<BVHBuildTask> tasks;
+	unsigned int taskCount;		// Tasks in use this build, the rest keep their node arrays for reuse
+	std::vector<unsigned int> taskOrder;
+	std::vector<std::pair<unsigned int, unsigned int>> collapseStack;
+
+	// LBVH scratch
+	std::vector<unsigned int> mortonCodes, sortedPrimitives, mortonCodesScratch, sortedPrimitivesScratch;
+	std::vector<unsigned int> sortedReferences;
+	std::vector<unsigned int> radixOffsets;
+	BVHPrimitiveCache sortedCache;
+
+	// PLOC scratch, also uses the LBVH scratch for sorting
+	std::vector<BVHClusterNode> clusterNodes;
+	std::vector<unsigned int> clusters, clustersScratch, neighbours, clusterChunkCounts;
+	std::vector<BVHClusterBounds> clusterBounds, clusterBoundsScratch;
+	std::vector<std::pair<unsigned int, unsigned int>> clusterStack; // <cluster node, tree node>
+	std::vector<unsigned int> clusterGatherStack;
+
+	// SBVH
+	float spatialSplitBudget;
+	int spatialSplitsLeft;
+	float sbvhRootArea;
+	std::vector<glm::vec3> sbvhVertices; // 4 per quad
 };
\ No newline at end of file
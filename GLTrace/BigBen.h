@@ -51,6 +51,9 @@ public:
 
 		SetQuadList(originalQuads);
 
+		// Every vertex moves each frame, PLOC rebuilds quickly without giving up much tree quality
+		SetBVHBuildMethod(BVH_BUILD_PLOC);
+
 		r = 0.0f;
 	}
 
@@ -2,5 +2,4 @@
 std::vector<Sphere> CPURTDEBUG::spheres;
 std::vector<Quad> CPURTDEBUG::quads;
 std::vector<BVHNode> CPURTDEBUG::tree;
-std::vector<unsigned int> CPURTDEBUG::quadIDs;
-std::vector<unsigned int> CPURTDEBUG::sphereIDs;
\ No newline at end of file
+std::vector<unsigned int> CPURTDEBUG::primitiveRefs;
\ No newline at end of file
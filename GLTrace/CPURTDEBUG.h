@@ -39,8 +39,7 @@ public:
 	static bool DebugBVHTraversal(const BVH_DEBUG_RAY& r, const BVH_DEBUG_INTERVAL& ray_t, BVH_DEBUG_HIT_RECORD& rec, float& closest_so_far, std::vector<Quad> quads, std::vector<Sphere> spheres, BVH bvh) {
 		CPURTDEBUG::quads = quads;
 		CPURTDEBUG::spheres = spheres;
-		CPURTDEBUG::quadIDs = bvh.GetQuadIDs();
-		CPURTDEBUG::sphereIDs = bvh.GetSphereIDs();
+		CPURTDEBUG::primitiveRefs = bvh.GetPrimitiveRefs();
 		CPURTDEBUG::tree = bvh.GetTree();
 
 		bool hit_anything = false;
@@ -283,36 +282,29 @@ protected:
 
 	static bool hit_bvh_primitives(const unsigned int nodeID, const BVH_DEBUG_RAY& r, const BVH_DEBUG_INTERVAL& ray_t, BVH_DEBUG_HIT_RECORD& rec, float& closest_so_far) {
 		bool hit_anything = false;
-		unsigned int firstSphereIndex = tree[nodeID].firstSpherePrimitive;
-		unsigned int firstQuadIndex = tree[nodeID].firstQuadPrimitive;
-		unsigned int totalQuads = tree[nodeID].quadPrimitiveCount;
-		unsigned int totalSpheres = tree[nodeID].spherePrimitiveCount;
+		unsigned int firstPrimitive = tree[nodeID].firstPrimitive;
+		unsigned int totalPrimitives = tree[nodeID].primitiveCount;
 
 		BVH_DEBUG_HIT_RECORD temp_hit;
 
-		// Test spheres
-		for (int i = 0; i < totalSpheres; i++) {
-			unsigned int sphereID = sphereIDs[firstSphereIndex + i];
-			//if (materials[spheres[sphereID].material_index].is_constant_medium) {
-			//	if (hit_sphere_volume(sphereID, r, new_interval(ray_t.tmin, closest_so_far), temp_hit)) {
-			//		hit_anything = true;
-			//		closest_so_far = temp_hit.t;
-			//		rec = temp_hit;
-			//	}
-			//}
-			//else {
-			if (hit_sphere(sphereID, r, BVH_DEBUG_INTERVAL(ray_t.tmin, closest_so_far), temp_hit)) {
-				hit_anything = true;
-				closest_so_far = temp_hit.t;
-				rec = temp_hit;
+		for (int i = 0; i < totalPrimitives; i++) {
+			unsigned int reference = primitiveRefs[firstPrimitive + i];
+			unsigned int primitiveID = BVHPrimitiveRef::Index(reference);
+
+			bool hit = false;
+			if (BVHPrimitiveRef::Type(reference) == BVH_PRIMITIVE_QUAD) {
+				hit = hit_quad(primitiveID, r, BVH_DEBUG_INTERVAL(ray_t.tmin, closest_so_far), temp_hit);
+			}
+			else {
+				//if (materials[spheres[primitiveID].material_index].is_constant_medium) {
+				//	hit = hit_sphere_volume(primitiveID, r, new_interval(ray_t.tmin, closest_so_far), temp_hit);
+				//}
+				//else {
+				hit = hit_sphere(primitiveID, r, BVH_DEBUG_INTERVAL(ray_t.tmin, closest_so_far), temp_hit);
+				//}
 			}
-			//}
-		}
 
-		// Test quads
-		for (int i = 0; i < totalQuads; i++) {
-			unsigned int quadID = quadIDs[firstQuadIndex + i];
-			if (hit_quad(quadID, r, BVH_DEBUG_INTERVAL(ray_t.tmin, closest_so_far), temp_hit)) {
+			if (hit) {
 				hit_anything = true;
 				closest_so_far = temp_hit.t;
 				rec = temp_hit;
@@ -326,5 +318,5 @@ protected:
 	static std::vector<Quad> quads;
 
 	static std::vector<BVHNode> tree;
-	static std::vector<unsigned int> quadIDs, sphereIDs;
+	static std::vector<unsigned int> primitiveRefs;
 };
\ No newline at end of file
@@ -99,6 +99,7 @@ public:
 	const unsigned int GetImageWidth() const { return image_width; }
 	const unsigned int GetImageHeight() const { return image_height; }
 	const float GetAspectRatio() const { return aspect_ratio; }
+	const int GetSqrtSamplesPerPixel() const { return sqrt_spp; }
 
 	const glm::mat4 GetViewMatrix() const {
 		return glm::lookAt(lookfrom, lookfrom - w, v);
@@ -151,8 +151,8 @@ class ComputeShader : public AbstractShader
 {
 public:
 	ComputeShader() : AbstractShader() {}
-	ComputeShader(const char* cPath) : AbstractShader() {
-		LoadShader(cPath);
+	ComputeShader(const char* cPath, const char* defines = nullptr) : AbstractShader() {
+		LoadShader(cPath, defines);
 	}
 	~ComputeShader() {
 		std::unordered_map<unsigned int, ShaderStorageBuffer*>::const_iterator ssboIt = shaderStorageBufferMap.begin();
@@ -162,7 +162,8 @@ public:
 		}
 	}
 
-	bool LoadShader(const char* cPath) {
+	// defines are inserted after the #version line, so one source file can hold several kernels
+	bool LoadShader(const char* cPath, const char* defines = nullptr) {
 		// retrieve source code from file
 		std::string computeCode;
 		std::ifstream cShaderFile;
@@ -190,6 +191,11 @@ public:
 			return false;
 		}
 
+		if (defines) {
+			const size_t versionEnd = computeCode.find('\n');
+			computeCode.insert(versionEnd == std::string::npos ? computeCode.size() : versionEnd + 1, defines);
+		}
+
 		const char* cShaderCode = computeCode.c_str();
 
 		//  compile shader
@@ -242,6 +248,12 @@ public:
 	}
 	void DispatchCompute(const unsigned int xGroups = 1, const unsigned int yGroups = 1, const unsigned int zGroups = 1, GLbitfield barrierBits = GL_ALL_BARRIER_BITS) {
 		//SCOPE_TIMER("ComputeShader::DispatchCompute");
+		Dispatch(xGroups, yGroups, zGroups, barrierBits);
+		sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// Dispatch without a fence, for passes queued back to back that are never waited on individually
+	void Dispatch(const unsigned int xGroups = 1, const unsigned int yGroups = 1, const unsigned int zGroups = 1, GLbitfield barrierBits = GL_ALL_BARRIER_BITS) {
 		assert(xGroups >= 1, "ERROR::ComputeShader::xGroups cannot be less than one");
 		assert(yGroups >= 1, "ERROR::ComputeShader::yGroups cannot be less than one");
 		assert(zGroups >= 1, "ERROR::ComputeShader::zGroups cannot be less than one");
@@ -255,8 +267,17 @@ public:
 		glDispatchCompute(xGroups, yGroups, zGroups);
 
 		glMemoryBarrier(barrierBits);
+	}
 
-		sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	// Group counts are read on the GPU from three uints at offset into argsBuffer
+	void DispatchIndirect(const ShaderStorageBuffer& argsBuffer, const GLintptr offset, GLbitfield barrierBits = GL_ALL_BARRIER_BITS) {
+		Use();
+		BindStorageBuffersForDispatch();
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, argsBuffer.GetID());
+		glDispatchComputeIndirect(offset);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+		glMemoryBarrier(barrierBits);
 	}
 
 	const GLenum Sync(const GLuint64 nanoSecondsTimeout = 1000000) const {
@@ -101,4 +101,5 @@ int main()
 	}
 
 	delete scene;
+	ThreadPool::Shutdown();
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include <glm/ext/vector_float3.hpp>
 #include <glm/ext/quaternion_geometric.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 #include "Shader.h"
 
 struct HittableTransform {
@@ -9,6 +10,25 @@ struct HittableTransform {
 	glm::vec3 scale = glm::vec3(1.0f);
 };
 
+// Model matrix and its inverse as 3x4 affine rows (stored as mat3x4 columns), matches affine_transform in RTCompute.comp
+struct GPUTransform {
+	GPUTransform() {}
+	GPUTransform(const glm::mat4& transform) : to_world(glm::transpose(glm::mat4x3(transform))), to_object(glm::transpose(glm::mat4x3(glm::affineInverse(transform)))) {}
+
+	glm::mat3x4 to_world;
+	glm::mat3x4 to_object;
+};
+
+// Emissive sphere or quad sampled directly by the shader, matches light in RTCompute.comp
+struct Light {
+	Light(const unsigned int primitiveRef, const float power, const float area) : primitiveRef(primitiveRef), cdf(power), probability(power), area(area) {}
+
+	unsigned int primitiveRef; // Indexes the uploaded sphere or quad buffer
+	float cdf; // Selection probability of this light and every light before it
+	float probability;
+	float area; // World space
+};
+
 struct MaterialSet {
 	int albedo_index = -1;
 	int normal_index = -1;
@@ -118,6 +138,16 @@ public:
 		Normal.a = transformID;
 	}
 
+	// Copy with Q, U and V moved into world space alongside the plane data, as uploaded to the GPU
+	Quad WorldSpace(const glm::mat4& transform) const {
+		Quad world = *this;
+		world.Recalculate(transform);
+		world.Q = transform * Q;
+		world.U = glm::vec4(glm::vec3(transform * glm::vec4(glm::vec3(Q + U), 1.0f) - world.Q), 1.0f);
+		world.V = glm::vec4(glm::vec3(transform * glm::vec4(glm::vec3(Q + V), 1.0f) - world.Q), 1.0f);
+		return world;
+	}
+
 	const glm::vec4& GetQ() const { return Q; }
 	const glm::vec4& GetU() const { return U; }
 	const glm::vec4& GetV() const { return V; }
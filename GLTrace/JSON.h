@@ -172,7 +172,12 @@ public:
 	static void WriteSceneToJSON(const char* filepath, const Scene& scene) {
 		json j;
 		j["scene"] = {
-			{"name", scene.GetName()}
+			{"name", scene.GetName()},
+			{"bvh_build_method", (unsigned int)scene.GetBVH().GetBuildMethod()},
+			{"bvh_spatial_split_budget", scene.GetBVH().GetSpatialSplitBudget()},
+			{"bvh_build_quality", (unsigned int)scene.GetBVH().GetBuildQuality()},
+			{"bvh_optimisation_passes", scene.GetBVH().GetBuildSettings().optimisationPasses},
+			{"bvh_compress_wide", scene.GetBVH().GetBuildSettings().compressWideBVH}
 		};
 		const Camera& camera = scene.sceneCamera;
 		CameraToJSON(j, camera);
@@ -181,6 +186,8 @@ public:
 		MaterialsToJSON(j, scene.materials, scene.material_names);
 		SpheresToJSON(j, scene.spheres, scene.sphere_names);
 		QuadsToJSON(j, scene.quads, scene.quad_names);
+		MeshesToJSON(j, scene.tlas, scene.mesh_names);
+		MeshInstancesToJSON(j, scene.tlas.GetInstances(), scene.instance_names, scene.mesh_names);
 		TransformBufferToJSON(j, scene.transformBuffer);
 
 		std::ofstream out_file(filepath);
@@ -201,6 +208,18 @@ public:
 
 			std::string scene_name = j.at("scene").at("name").get<std::string>();
 			Scene* scene = new EmptyScene(scene_name);
+			const unsigned int build_method = j.at("scene").value("bvh_build_method", (unsigned int)BVH_BUILD_SAH);
+			scene->SetBVHBuildMethod(build_method < BVH_BUILD_METHOD_COUNT ? (BVHBuildMethod)build_method : BVH_BUILD_SAH);
+			scene->SetBVHSpatialSplitBudget(j.at("scene").value("bvh_spatial_split_budget", scene->GetBVH().GetSpatialSplitBudget()));
+			const unsigned int build_quality = j.at("scene").value("bvh_build_quality", (unsigned int)BVH_QUALITY_BALANCED);
+			scene->SetBVHBuildQuality(build_quality < BVH_QUALITY_COUNT ? (BVHBuildQuality)build_quality : BVH_QUALITY_BALANCED);
+			scene->SetBVHOptimisationPasses(j.at("scene").value("bvh_optimisation_passes", 0u));
+			scene->SetBVHCompressWideBVH(j.at("scene").value("bvh_compress_wide", false));
+
+			// Cache sits beside the scene file, e.g. Scenes/TestScene.bvhcache
+			const std::string path = std::string(filepath);
+			const size_t extension = path.find_last_of('.');
+			scene->SetBVHCachePath(((extension == std::string::npos) ? path : path.substr(0, extension)) + ".bvhcache");
 			JSONToCamera(j, scene->sceneCamera);
 
 			std::vector<std::pair<std::vector<std::string>, unsigned int>> texture_sets;
@@ -230,6 +249,8 @@ public:
 
 			JSONToSpheres(j, scene);
 			JSONToQuads(j, scene);
+			JSONToMeshes(j, scene);
+			JSONToMeshInstances(j, scene);
 
 			std::vector<glm::mat4> transformBuffer;
 			JSONToTransforms(j, transformBuffer);
@@ -334,6 +355,37 @@ private:
 			};
 		}
 	}
+	// Triangles are stored inline in object space as Q, U and V, nine floats each
+	static void MeshesToJSON(nlohmann::json& j, const TLAS& tlas, const std::vector<std::string>& mesh_names) {
+		assert(tlas.GetMeshes().size() == mesh_names.size());
+		for (int i = 0; i < mesh_names.size(); i++) {
+			const std::vector<Quad> triangles = tlas.GetMeshQuads(i);
+			std::vector<float> vertices;
+			std::vector<unsigned int> material_indices;
+			vertices.reserve(triangles.size() * 9);
+			material_indices.reserve(triangles.size());
+			for (const Quad& triangle : triangles) {
+				vertices.insert(vertices.end(), { triangle.Q[0], triangle.Q[1], triangle.Q[2], triangle.U[0], triangle.U[1], triangle.U[2], triangle.V[0], triangle.V[1], triangle.V[2] });
+				material_indices.push_back(triangle.material_index);
+			}
+			j["meshes"][std::to_string(i)] = {
+				{"name", mesh_names[i]},
+				{"triangles", vertices},
+				{"material_indices", material_indices}
+			};
+		}
+	}
+	static void MeshInstancesToJSON(nlohmann::json& j, const std::vector<MeshInstance>& instances, const std::vector<std::string>& instance_names, const std::vector<std::string>& mesh_names) {
+		assert(instances.size() == instance_names.size());
+		for (int i = 0; i < instances.size(); i++) {
+			const MeshInstance& instance = instances[i];
+			j["mesh_instances"][std::to_string(i)] = {
+				{"mesh", mesh_names[instance.meshID]},
+				{"transform_ID", instance.transformID},
+				{"name", instance_names[i]}
+			};
+		}
+	}
 	static void TransformBufferToJSON(nlohmann::json& j, const std::vector<glm::mat4>& transform_buffer) {
 		for (int i = 0; i < transform_buffer.size(); i++) {
 			const glm::mat4& transform = transform_buffer[i];
@@ -483,6 +535,38 @@ private:
 			}
 		}
 	}
+	static void JSONToMeshes(const nlohmann::json& j, Scene* scene) {
+		if (!j.contains("meshes")) { return; }
+		auto& jsonMeshes = j.at("meshes");
+		const int num_meshes = jsonMeshes.size();
+		for (int i = 0; i < num_meshes; i++) {
+			auto& jsonMesh = jsonMeshes.at(std::to_string(i));
+			std::vector<float> readVertices = jsonMesh.at("triangles").get<std::vector<float>>();
+			std::vector<unsigned int> readMaterials = jsonMesh.at("material_indices").get<std::vector<unsigned int>>();
+
+			std::vector<Quad> triangles;
+			triangles.reserve(readMaterials.size());
+			for (int t = 0; t < readMaterials.size() && (t * 9) + 8 < readVertices.size(); t++) {
+				const float* v = &readVertices[t * 9];
+				triangles.push_back(Quad(TRIANGLE, glm::vec3(v[0], v[1], v[2]), glm::vec3(v[3], v[4], v[5]), glm::vec3(v[6], v[7], v[8]), 0, readMaterials[t]));
+			}
+			scene->AddMesh(jsonMesh.at("name").get<std::string>(), triangles);
+		}
+	}
+	static void JSONToMeshInstances(const nlohmann::json& j, Scene* scene) {
+		if (!j.contains("mesh_instances")) { return; }
+		auto& jsonInstances = j.at("mesh_instances");
+		const int num_instances = jsonInstances.size();
+		for (int i = 0; i < num_instances; i++) {
+			auto& jsonInstance = jsonInstances.at(std::to_string(i));
+			std::string instanceName = jsonInstance.at("name").get<std::string>();
+			std::string meshName = jsonInstance.at("mesh").get<std::string>();
+			unsigned int transformID = jsonInstance.at("transform_ID").get<unsigned int>();
+			if (scene->AddMeshInstance(instanceName, meshName)) {
+				scene->tlas.SetInstanceTransformID(scene->tlas.GetInstances().size() - 1, transformID);
+			}
+		}
+	}
 	static void JSONToTransforms(const nlohmann::json& j, std::vector<glm::mat4>& transforms) {
 		auto& jsonTransforms = j.at("transformBuffer");
 		const int num_transforms = jsonTransforms.size();
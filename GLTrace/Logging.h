@@ -2,17 +2,18 @@
 #include <glm/ext/vector_float4.hpp>
 #include <vector>
 #include <iostream>
+#include <string>
 struct LogEntry {
 public:
 	LogEntry(const char* type, const char* log, const glm::vec4& typeColour, const glm::vec4& logColour) : typeName(type), log(log), typeColour(typeColour), logColour(logColour) {}
 
 	const char* GetTypeName() const { return typeName; }
-	const char* GetLog() const { return log; }
+	const char* GetLog() const { return log.c_str(); }
 	const glm::vec4& GetTypeColour() const { return typeColour; }
 	const glm::vec4& GetLogColour() const { return logColour; }
 private:
 	const char* typeName;
-	const char* log;
+	std::string log; // Owned, messages are often built in temporary strings
 	const glm::vec4 typeColour;
 	const glm::vec4 logColour;
 };
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+// Read only view of a whole file mapped into memory, pages are only read from disk when first touched
+class MappedFile {
+public:
+	MappedFile(const char* filepath);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool IsOpen() const { return data != nullptr; }
+	const unsigned char* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+private:
+	const unsigned char* data;
+	size_t size;
+	void* fileHandle;
+	void* mappingHandle;
+};
\ No newline at end of file
@@ -40,10 +40,28 @@ void Renderer::RenderScene(Camera& activeCamera, const Scene& activeScene)
 
 		// Update scene information
 		activeScene.SetUniforms(rtCompute);
+		SetTraceUniforms(rtCompute);
+
+		// Wavefront kernels keep their path counters after the queue counters, see RTCompute.comp
+		const ShaderStorageBuffer* statisticsSSBO = rtCompute.GetSSBO(dispatch_mode == DISPATCH_WAVEFRONT ? 14 : 19);
+		const GLintptr statisticsOffset = dispatch_mode == DISPATCH_WAVEFRONT ? sizeof(unsigned int) * 12 : 0;
+		if (path_statistics) {
+			if (dispatch_mode == DISPATCH_WAVEFRONT) { ResizeWavefrontQueues(SCR_WIDTH * SCR_HEIGHT); }
+			const PathStatistics cleared;
+			statisticsSSBO->BufferSubData(&cleared, sizeof(PathStatistics), statisticsOffset);
+		}
 
 		// Dispatch RT compute shader
 		screenBuffers.BindImage(GL_WRITE_ONLY, 0);
-		rtCompute.DispatchCompute(SCR_WIDTH / WORK_GROUP_SIZE, SCR_HEIGHT / WORK_GROUP_SIZE, 1, GL_ALL_BARRIER_BITS);
+		if (dispatch_mode == DISPATCH_WAVEFRONT) {
+			DispatchWavefront(activeCamera, activeScene);
+		}
+		else {
+			ResizeWavefrontQueues(0u);
+			if (dispatch_mode == DISPATCH_PERSISTENT) { DispatchPersistent(activeCamera, activeScene); }
+			else { rtCompute.DispatchCompute(SCR_WIDTH / WORK_GROUP_SIZE, SCR_HEIGHT / WORK_GROUP_SIZE, 1, GL_ALL_BARRIER_BITS); }
+		}
+		if (path_statistics) { statisticsSSBO->ReadBufferSubData(&frame_path_statistics, sizeof(PathStatistics), statisticsOffset); }
 
 		// Render screen quad
 		glBindFramebuffer(GL_FRAMEBUFFER, finalImageFBO);
@@ -57,6 +75,100 @@ void Renderer::RenderScene(Camera& activeCamera, const Scene& activeScene)
 	}
 }
 
+void Renderer::DispatchPersistent(const Camera& activeCamera, const Scene& activeScene)
+{
+	activeCamera.SetUniforms(persistentCompute);
+	persistentCompute.setInt("accumulation_frame_index", accumulation_frame_index);
+	activeScene.SetUniforms(persistentCompute);
+	SetTraceUniforms(persistentCompute);
+
+	// No more groups than there are pixels to hand out
+	const unsigned int pixelCount = SCR_WIDTH * SCR_HEIGHT;
+	const unsigned int groups = std::min((unsigned int)std::max(persistent_groups, 1), (pixelCount + PERSISTENT_GROUP_SIZE - 1) / PERSISTENT_GROUP_SIZE);
+
+	const unsigned int firstWorkItem = 0u;
+	rtCompute.GetSSBO(18)->BufferSubData(&firstWorkItem, sizeof(unsigned int), 0);
+	persistentCompute.DispatchCompute(groups, 1, 1, GL_ALL_BARRIER_BITS);
+}
+
+void Renderer::DispatchWavefront(const Camera& activeCamera, const Scene& activeScene)
+{
+	const unsigned int pixelCount = SCR_WIDTH * SCR_HEIGHT;
+	const unsigned int pixelGroups = (pixelCount + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+	const unsigned int samples = activeCamera.GetSqrtSamplesPerPixel() * activeCamera.GetSqrtSamplesPerPixel();
+	const GLbitfield barrierBits = GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_COMMAND_BARRIER_BIT;
+	ResizeWavefrontQueues(pixelCount);
+
+	ComputeShader* kernels[] = { &wavefrontGenerate, &wavefrontExtend, &wavefrontShade, &wavefrontAccumulate };
+	for (ComputeShader* kernel : kernels) {
+		activeCamera.SetUniforms(*kernel);
+		kernel->setInt("accumulation_frame_index", accumulation_frame_index);
+	}
+	activeScene.SetUniforms(wavefrontExtend);
+	SetTraceUniforms(wavefrontExtend);
+	activeScene.SetUniforms(wavefrontShade);
+	SetTraceUniforms(wavefrontShade);
+
+	// Extend and shade are sized on the GPU from the queue counts, arguments live in the counter buffer
+	const ShaderStorageBuffer& counterSSBO = *rtCompute.GetSSBO(14);
+	const GLintptr extendArgsOffset = sizeof(unsigned int) * 4;
+	const GLintptr shadeArgsOffset = sizeof(unsigned int) * 8;
+
+	for (unsigned int sample = 0; sample < samples; sample++) {
+		wavefrontGenerate.Use();
+		wavefrontGenerate.setUInt("wavefront_sample", sample);
+		wavefrontGenerate.Dispatch(pixelGroups, 1, 1, barrierBits);
+
+		unsigned int queue = 0;
+		for (int bounce = 0; bounce < activeCamera.max_bounces; bounce++) {
+			wavefrontDispatch.Use();
+			wavefrontDispatch.setUInt("wavefront_queue", queue);
+			wavefrontDispatch.setUInt("wavefront_stage", 0u);
+			wavefrontDispatch.Dispatch(1, 1, 1, barrierBits);
+
+			wavefrontExtend.Use();
+			wavefrontExtend.setUInt("wavefront_queue", queue);
+			wavefrontExtend.DispatchIndirect(counterSSBO, extendArgsOffset, barrierBits);
+
+			wavefrontDispatch.Use();
+			wavefrontDispatch.setUInt("wavefront_stage", 1u);
+			wavefrontDispatch.Dispatch(1, 1, 1, barrierBits);
+
+			wavefrontShade.Use();
+			wavefrontShade.setUInt("wavefront_queue", queue);
+			wavefrontShade.DispatchIndirect(counterSSBO, shadeArgsOffset, barrierBits);
+
+			queue = 1u - queue;
+		}
+	}
+
+	wavefrontAccumulate.Dispatch(pixelGroups, 1, 1, GL_ALL_BARRIER_BITS);
+}
+
+void Renderer::ResizeWavefrontQueues(const unsigned int pixelCount)
+{
+	if (pixelCount == wavefront_capacity) { return; }
+	wavefront_capacity = pixelCount;
+
+	// Ray queue entries are 64 bytes and hit queue entries 48, see path_ray and path_hit in RTCompute.comp
+	const GLsizeiptr rayEntrySize = sizeof(float) * 16;
+	const GLsizeiptr hitEntrySize = sizeof(float) * 12;
+	rtCompute.GetSSBO(14)->BufferData(nullptr, (sizeof(unsigned int) * 12) + sizeof(PathStatistics), GL_DYNAMIC_COPY);
+	rtCompute.GetSSBO(15)->BufferData(nullptr, rayEntrySize * pixelCount * 2, GL_DYNAMIC_COPY);
+	rtCompute.GetSSBO(16)->BufferData(nullptr, hitEntrySize * pixelCount, GL_DYNAMIC_COPY);
+	rtCompute.GetSSBO(17)->BufferData(nullptr, sizeof(glm::vec4) * pixelCount, GL_DYNAMIC_COPY);
+}
+
+// Path tracing options shared by every kernel that shades hits, the shader must be in use
+void Renderer::SetTraceUniforms(const ComputeShader& shader) const
+{
+	shader.setBool("next_event_estimation", next_event_estimation);
+	shader.setBool("multiple_importance_sampling", multiple_importance_sampling);
+	shader.setBool("russian_roulette", russian_roulette);
+	shader.setInt("russian_roulette_depth", russian_roulette_depth);
+	shader.setBool("path_statistics", path_statistics);
+}
+
 void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 {
 	// ImGui frame start
@@ -72,6 +184,7 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 	static int selected_material_set = 0;
 	const int num_spheres = activeScene.GetSpheres().size();
 	const int num_quads = activeScene.GetQuads().size();
+	const int num_instances = activeScene.GetTLAS().GetInstances().size();
 	const int num_materials = activeScene.GetMaterials().size();
 	const int num_material_sets = activeScene.GetMaterialSets().size();
 
@@ -390,6 +503,26 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 			}
 		}
 
+		// Mesh instances
+		// --------------
+		if (num_instances > 0) {
+			ImGui::SetNextItemOpen(true, ImGuiCond_Once);
+			if (ImGui::TreeNode("Mesh Instances")) {
+
+				ImGuiListClipper clipper;
+				clipper.Begin(num_instances);
+				while (clipper.Step()) {
+					for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+						if (ImGui::Selectable(activeScene.GetMeshInstanceName(i).c_str(), selected == i + num_spheres + num_quads + 1)) {
+							selected = i + num_spheres + num_quads + 1;
+						}
+					}
+				}
+				ImGui::Separator();
+				ImGui::TreePop();
+			}
+		}
+
 		ImGui::PopStyleVar(1);
 	}
 	ImGui::EndChild();
@@ -463,6 +596,50 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 				ImGui::InputInt("Max bounces", &activeCamera.max_bounces);
 				ImGui::SetItemTooltip("Maximum times a ray can bounce off of scene geometry.\r\nHigher values will increase visual accuracy at expense of performance.");
 
+				const char* dispatch_modes[DISPATCH_MODE_COUNT] = { "Per pixel", "Persistent threads", "Wavefront" };
+				if (ImGui::BeginCombo("Dispatch", dispatch_modes[dispatch_mode])) {
+					for (unsigned int i = 0; i < DISPATCH_MODE_COUNT; i++) {
+						if (ImGui::Selectable(dispatch_modes[i], dispatch_mode == i)) {
+							dispatch_mode = (RenderDispatchMode)i;
+							ResetAccumulation();
+						}
+
+						if (dispatch_mode == i) {
+							ImGui::SetItemDefaultFocus();
+						}
+					}
+					ImGui::EndCombo();
+				}
+				ImGui::SetItemTooltip("Per pixel: one thread traces every sample of its pixel.\r\nPersistent threads: a fixed pool of threads fetch pixels until the frame is done, so threads whose paths end early pick up more work.\r\nWavefront: paths are traced by separate generate, extend, shade and accumulate passes.");
+				if (dispatch_mode == DISPATCH_PERSISTENT) {
+					ImGui::InputInt("Persistent groups", &persistent_groups, 64, 256);
+					ImGui::SetItemTooltip("Number of %u thread workgroups kept alive for the frame, should be enough to fill the GPU.", PERSISTENT_GROUP_SIZE);
+				}
+
+				if (ImGui::Checkbox("Next event estimation", &next_event_estimation)) { ResetAccumulation(); }
+				ImGui::SetItemTooltip("When enabled, diffuse surfaces sample emissive spheres and quads directly with a shadow ray.\r\nSmall lights converge in far fewer frames.");
+				if (next_event_estimation) {
+					ImGui::SameLine();
+					if (ImGui::Checkbox("MIS", &multiple_importance_sampling)) { ResetAccumulation(); }
+					ImGui::SetItemTooltip("When enabled, light samples and diffuse bounces that find the same light are weighted by the power heuristic.\r\nWhen disabled, light reached by a diffuse bounce is left to the light sample.");
+				}
+
+				if (ImGui::Checkbox("Russian roulette", &russian_roulette)) { ResetAccumulation(); }
+				ImGui::SetItemTooltip("When enabled, paths past the roulette depth are randomly ended based on their throughput.\r\nSurviving paths are brightened to compensate, so dark paths stop early without biasing the image.");
+				if (russian_roulette) {
+					if (ImGui::InputInt("Roulette depth", &russian_roulette_depth)) {
+						russian_roulette_depth = std::max(russian_roulette_depth, 0);
+						ResetAccumulation();
+					}
+					ImGui::SetItemTooltip("Bounces every path makes before russian roulette can end it.");
+				}
+
+				ImGui::Checkbox("Path statistics", &path_statistics);
+				ImGui::SetItemTooltip("Counts the ray segments of every path on the GPU and reads them back each frame.");
+				if (path_statistics && frame_path_statistics.paths > 0) {
+					ImGui::Text("Path length: %.2f average, %u longest", (float)frame_path_statistics.segments / frame_path_statistics.paths, frame_path_statistics.longest);
+				}
+
 				ImGui::Checkbox("Accumulation", &accumulate_frames);
 				ImGui::SetItemTooltip("When enabled, final render will use an accumulation of previous frames, effectively gathering samples over multiple frames.\r\nWorks best with static scenes.");
 				if (accumulate_frames) {
@@ -501,6 +678,7 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 	else if (selected > 0) {
 		int sphereID = selected - 1;
 		int quadID = selected - (num_spheres + 1);
+		int instanceID = selected - (num_spheres + num_quads + 1);
 
 		if (sphereID < num_spheres) {
 			// Sphere selected
@@ -641,7 +819,7 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 					ImGui::Spacing();
 					if (ImGui::DragFloat3("Vertical extent", &quad->V[0])) { quad_has_changed = true; }
 
-					if (quad_has_changed) { quad->Recalculate(*activeScene.GetTransform(num_spheres + quadID)); ResetAccumulation(); }
+					if (quad_has_changed) { quad->Recalculate(*activeScene.GetQuadTransform(quadID)); ResetAccumulation(); }
 
 					selected_quad_type = quad->triangle_disk_id;
 					const char* quad_types[3] = { "Quad", "Triangle", "Disk" };
@@ -704,6 +882,64 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 			}
 			ImGui::EndChild();
 		}
+		else if (instanceID < num_instances) {
+			// Mesh instance selected
+			const MeshInstance& instance = activeScene.GetTLAS().GetInstances()[instanceID];
+			const std::string& instanceName = activeScene.GetMeshInstanceName(instanceID);
+
+			ImGui::Text(instanceName.c_str());
+			ImGui::SameLine();
+
+			float buttonWidth = ImGui::CalcTextSize("Delete instance").x + ImGui::GetStyle().FramePadding.x * 2;
+			float spaceAvailable = ImGui::GetContentRegionAvail().x;
+			ImGui::SetCursorPosX(ImGui::GetCursorPosX() + spaceAvailable - buttonWidth);
+
+			const std::string& meshName = activeScene.GetMeshName(instance.meshID);
+			const unsigned int meshTriangles = activeScene.GetTLAS().GetMeshes()[instance.meshID].quadCount;
+			if (ImGui::Button("Delete instance")) {
+				activeScene.RemoveMeshInstance(instanceID);
+				selected--;
+				ResetAccumulation();
+			}
+
+			ImGui::Separator();
+			if (ImGui::BeginChild("ScrollingRegion", ImVec2(0, 0), ImGuiChildFlags_NavFlattened, ImGuiWindowFlags_HorizontalScrollbar)) {
+				ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4, 6));
+
+				ImGui::SetNextItemOpen(true, ImGuiCond_Once);
+				if (ImGui::TreeNode("Transform")) {
+					glm::mat4* transform = activeScene.GetMeshInstanceTransform(instanceID);
+
+					if (transform) {
+						glm::vec3 translation, rotation, scale;
+						ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(*transform), &translation[0], &rotation[0], &scale[0]);
+
+						if (ImGui::DragFloat3("Translation", &translation[0], 0.1f)) {
+							ResetAccumulation();
+						}
+						if (ImGui::DragFloat3("Rotation", &rotation[0], 0.1f)) {
+							ResetAccumulation();
+						}
+						if (ImGui::DragFloat3("Scale", &scale[0], 0.01f, 0.001f, 10000.0f)) {
+							ResetAccumulation();
+						}
+						ImGuizmo::RecomposeMatrixFromComponents(&translation[0], &rotation[0], &scale[0], glm::value_ptr(*transform));
+					}
+					ImGui::TreePop();
+					ImGui::Separator();
+				}
+				ImGui::SetNextItemOpen(true, ImGuiCond_Once);
+				if (ImGui::TreeNode("Mesh")) {
+					ImGui::Text("Name: %s", meshName.c_str());
+					ImGui::Text("Triangles: %u", meshTriangles);
+					ImGui::TreePop();
+					ImGui::Separator();
+				}
+
+				ImGui::PopStyleVar(1);
+			}
+			ImGui::EndChild();
+		}
 	}
 	ImGui::End();
 
@@ -908,6 +1144,102 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 	}
 	ImGui::End();
 
+	// BVH details
+	// -----------
+	ImGui::Begin("BVH");
+	{
+		const BVH& bvh = activeScene.GetBVH();
+
+		// Build options are saved with the scene, changing one rebuilds the tree
+		bool rebuild = false;
+		const BVHBuildMethod buildMethod = bvh.GetBuildMethod();
+		const char* build_methods[BVH_BUILD_METHOD_COUNT] = { "Binned SAH", "LBVH", "SBVH", "PLOC" };
+		if (ImGui::BeginCombo("Build method", build_methods[buildMethod])) {
+			for (unsigned int i = 0; i < BVH_BUILD_METHOD_COUNT; i++) {
+				if (ImGui::Selectable(build_methods[i], buildMethod == i)) {
+					activeScene.SetBVHBuildMethod((BVHBuildMethod)i);
+					rebuild = true;
+				}
+
+				if (buildMethod == i) {
+					ImGui::SetItemDefaultFocus();
+				}
+			}
+			ImGui::EndCombo();
+		}
+		ImGui::SetItemTooltip("Binned SAH: best trace performance.\r\nLBVH: fastest build, for geometry that changes every frame.\r\nSBVH: splits large and overlapping primitives, slowest build but fastest traces for static scenes.\r\nPLOC: close to SAH quality at close to LBVH build speed.");
+		const BVHBuildQuality buildQuality = bvh.GetBuildQuality();
+		const char* build_qualities[BVH_QUALITY_COUNT] = { "Fast", "Balanced", "High" };
+		if (ImGui::BeginCombo("Build quality", build_qualities[buildQuality])) {
+			for (unsigned int i = 0; i < BVH_QUALITY_COUNT; i++) {
+				if (ImGui::Selectable(build_qualities[i], buildQuality == i)) {
+					activeScene.SetBVHBuildQuality((BVHBuildQuality)i);
+					rebuild = true;
+				}
+
+				if (buildQuality == i) {
+					ImGui::SetItemDefaultFocus();
+				}
+			}
+			ImGui::EndCombo();
+		}
+		ImGui::SetItemTooltip("Fast: 8 SAH bins and up to 8 primitives per leaf.\r\nBalanced: 16 SAH bins and up to 4 primitives per leaf.\r\nHigh: evaluates every primitive boundary instead of binning.");
+		if (buildMethod == BVH_BUILD_SBVH) {
+			float splitBudget = bvh.GetSpatialSplitBudget();
+			if (ImGui::InputFloat("Split budget", &splitBudget, 0.05f, 0.25f, "%.2f")) {
+				activeScene.SetBVHSpatialSplitBudget(splitBudget);
+				rebuild = true;
+			}
+			ImGui::SetItemTooltip("Extra primitive references spatial splits may create, as a fraction of the primitive count.");
+		}
+		bool compressWide = bvh.GetBuildSettings().compressWideBVH;
+		if (ImGui::Checkbox("Compress wide BVH", &compressWide)) {
+			activeScene.SetBVHCompressWideBVH(compressWide);
+			activeScene.RefitBVH();
+		}
+		ImGui::SetItemTooltip("Quantises child bounds to 8 bits per plane, 80 byte nodes instead of 128 for slightly looser bounds.");
+		if (rebuild) { activeScene.BuildBVH(); }
+		ImGui::Separator();
+
+		// Both are kept on the BVH and dropped whenever it is rebuilt, refitted or edited
+		const BVHStats& bvhStats = bvh.GetStats();
+		if (ImGui::Button("Validate")) {
+			bvh.ValidateCurrent();
+		}
+		ImGui::Separator();
+
+		ImGui::Text("%s: %.2f ms", bvhStats.loadedFromCache ? "Loaded from cache" : "Build time", bvhStats.buildMilliseconds);
+		ImGui::Text("Nodes: %u (%u leaves)", bvhStats.nodeCount, bvhStats.leafCount);
+		ImGui::Text("Primitive references: %u", bvhStats.referenceCount);
+		ImGui::Text("Depth: %u max, %.1f average leaf", bvhStats.maxDepth, bvhStats.averageLeafDepth);
+		ImGui::Text("SAH cost: %.2f", bvhStats.sahCost);
+		ImGui::Text("Worst leaf: %.1f%% of SAH cost", bvhStats.worstLeafCost * 100.0f);
+		ImGui::Text("Sibling overlap: %.2f total, %.1f%% worst", bvhStats.overlapCost, bvhStats.maxOverlap * 100.0f);
+
+		// Leaf size histogram
+		float leafSizes[BVHStats::LEAF_HISTOGRAM_SIZE];
+		for (unsigned int i = 0; i < BVHStats::LEAF_HISTOGRAM_SIZE; i++) {
+			leafSizes[i] = (float)bvhStats.leafSizeHistogram[i];
+		}
+		const std::string histogramLabel = "Leaf sizes 1-" + std::to_string(BVHStats::LEAF_HISTOGRAM_SIZE) + "+, largest " + std::to_string(bvhStats.largestLeaf);
+		ImGui::PlotHistogram("##LeafSizes", leafSizes, BVHStats::LEAF_HISTOGRAM_SIZE, 0, histogramLabel.c_str(), 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+
+		const BVHValidation* bvhValidation = bvh.GetValidation();
+		if (bvhValidation) {
+			ImGui::Separator();
+			if (bvhValidation->valid) {
+				ImGui::TextColored(ImVec4(0.0f, 1.0f, 0.0f, 1.0f), "Valid");
+			}
+			else {
+				ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Invalid");
+				ImGui::Text("Unreachable primitives: %u", bvhValidation->unreachablePrimitives);
+				ImGui::Text("Children outside parent bounds: %u", bvhValidation->uncontainedChildren);
+				ImGui::Text("Invalid nodes: %u", bvhValidation->invalidNodes);
+			}
+		}
+	}
+	ImGui::End();
+
 	// Scene view
 	// ----------
 	if (ImGui::Begin("Viewport", nullptr, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoTitleBar)) {
@@ -953,6 +1285,7 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 
 			int sphereID = selected - 1;
 			int quadID = selected - (num_spheres + 1);
+			int instanceID = selected - (num_spheres + num_quads + 1);
 
 			glm::mat4* transform = nullptr;
 			glm::mat4 offsetTransform = glm::mat4(1.0f);
@@ -973,6 +1306,9 @@ void Renderer::SetupUI(Camera& activeCamera, Scene& activeScene, const float dt)
 				offsetTransform = glm::translate(offsetTransform, origin);
 				inverseOffsetTransform = glm::translate(inverseOffsetTransform, -origin);
 			}
+			else if (instanceID < num_instances) {
+				transform = activeScene.GetMeshInstanceTransform(instanceID);
+			}
 
 			if (transform) {
 				glm::mat4 transformedMatrix = offsetTransform * (*transform);
@@ -78,28 +78,69 @@ static void APIENTRY glDebugOutput(GLenum source, GLenum type, unsigned int id,
 }
 
 const unsigned int WORK_GROUP_SIZE = 32u;
+const unsigned int WAVEFRONT_GROUP_SIZE = 256u; // Matches local_size_x of the wavefront kernels in RTCompute.comp
+const unsigned int PERSISTENT_GROUP_SIZE = 64u; // Matches local_size_x of the persistent threads kernel in RTCompute.comp
+
+// How the path tracing work of a frame is handed to the GPU
+enum RenderDispatchMode {
+	DISPATCH_PER_PIXEL, // One megakernel thread per pixel
+	DISPATCH_PERSISTENT, // Fixed pool of megakernel groups fetching pixels from an atomic counter
+	DISPATCH_WAVEFRONT, // Separate generate, extend, shade and accumulate passes
+	DISPATCH_MODE_COUNT
+};
+
+// Path length counters written by the shader over a frame, matches pathStatisticsBuffer in RTCompute.comp
+struct PathStatistics {
+	unsigned int paths = 0;
+	unsigned int segments = 0; // Wraps past 2^32 ray segments in a frame
+	unsigned int longest = 0;
+	unsigned int padding = 0;
+};
 
 class Renderer
 {
 public:
-	Renderer(const unsigned int width = 600u, const unsigned int height = 600u, unsigned int xPos = 0u, unsigned int yPos = 0u) : SCR_WIDTH(width), SCR_HEIGHT(height), SCR_X_POS(xPos), SCR_Y_POS(yPos), accumulation_frame_index(1), accumulate_frames(true), auto_reset_accumulation(true) {
+	Renderer(const unsigned int width = 600u, const unsigned int height = 600u, unsigned int xPos = 0u, unsigned int yPos = 0u) : SCR_WIDTH(width), SCR_HEIGHT(height), SCR_X_POS(xPos), SCR_Y_POS(yPos), accumulation_frame_index(1), accumulate_frames(true), auto_reset_accumulation(true), dispatch_mode(DISPATCH_PER_PIXEL), persistent_groups(1024), next_event_estimation(true), multiple_importance_sampling(true), russian_roulette(true), russian_roulette_depth(3), path_statistics(false), wavefront_capacity(0u) {
 		Initialise(); 
 
 		// Load shaders
 		screenQuadShader.LoadShader("Shaders/passthrough.vert", "Shaders/screenQuad.frag");
 		rtCompute.LoadShader("Shaders/RTCompute.comp");
-
-		rtCompute.Use();
-		const int max_textures = 31;
-		for (int i = 0; i <= max_textures; i++) {
-			rtCompute.setInt("material_textures[" + std::to_string(i) + "]", i + 7);
+		persistentCompute.LoadShader("Shaders/RTCompute.comp", "#define PERSISTENT_THREADS\n");
+		wavefrontGenerate.LoadShader("Shaders/RTCompute.comp", "#define WAVEFRONT_GENERATE\n");
+		wavefrontDispatch.LoadShader("Shaders/RTCompute.comp", "#define WAVEFRONT_DISPATCH\n");
+		wavefrontExtend.LoadShader("Shaders/RTCompute.comp", "#define WAVEFRONT_EXTEND\n");
+		wavefrontShade.LoadShader("Shaders/RTCompute.comp", "#define WAVEFRONT_SHADE\n");
+		wavefrontAccumulate.LoadShader("Shaders/RTCompute.comp", "#define WAVEFRONT_ACCUMULATE\n");
+
+		ComputeShader* texturedShaders[] = { &rtCompute, &persistentCompute, &wavefrontExtend, &wavefrontShade };
+		for (ComputeShader* shader : texturedShaders) {
+			shader->Use();
+			const int max_textures = 31;
+			for (int i = 0; i <= max_textures; i++) {
+				shader->setInt("material_textures[" + std::to_string(i) + "]", i + MATERIAL_TEXTURE_SLOT);
+			}
 		}
 		rtCompute.AddNewSSBO(1); // BVH buffer
-		rtCompute.AddNewSSBO(2); // Sphere ID buffer
-		rtCompute.AddNewSSBO(3); // Quad ID buffer
+		rtCompute.AddNewSSBO(2); // Primitive reference buffer
+		rtCompute.AddNewSSBO(3); // Light buffer
 		rtCompute.AddNewSSBO(4); // Sphere buffer
 		rtCompute.AddNewSSBO(5); // Quad buffer
 		rtCompute.AddNewSSBO(6); // Transform buffer
+		rtCompute.AddNewSSBO(7); // TLAS buffer
+		rtCompute.AddNewSSBO(8); // Mesh instance buffer
+		rtCompute.AddNewSSBO(9); // BLAS buffer
+		rtCompute.AddNewSSBO(11); // Mesh quad buffer
+		rtCompute.AddNewSSBO(12); // Wide BVH buffer
+		rtCompute.AddNewSSBO(13); // Compressed wide BVH buffer
+		rtCompute.AddNewSSBO(14); // Wavefront counter buffer
+		rtCompute.AddNewSSBO(15); // Wavefront ray queue buffer
+		rtCompute.AddNewSSBO(16); // Wavefront hit queue buffer
+		rtCompute.AddNewSSBO(17); // Wavefront pixel radiance buffer
+		rtCompute.AddNewSSBO(18); // Persistent threads work counter
+		rtCompute.GetSSBO(18)->BufferData(nullptr, sizeof(unsigned int), GL_DYNAMIC_COPY);
+		rtCompute.AddNewSSBO(19); // Path statistics buffer
+		rtCompute.GetSSBO(19)->BufferData(nullptr, sizeof(PathStatistics), GL_DYNAMIC_COPY);
 
 		// Set up screen quad
 		std::vector<Vertex> vertices;
@@ -223,6 +264,10 @@ private:
 	bool InitIMGUI();
 
 	void RenderScene(Camera& activeCamera, const Scene& activeScene);
+	void DispatchPersistent(const Camera& activeCamera, const Scene& activeScene);
+	void DispatchWavefront(const Camera& activeCamera, const Scene& activeScene);
+	void ResizeWavefrontQueues(const unsigned int pixelCount);
+	void SetTraceUniforms(const ComputeShader& shader) const;
 	void SetupUI(Camera& activeCamera, Scene& activeScene, const float dt);
 
 	Texture2DArray screenBuffers;
@@ -230,6 +275,14 @@ private:
 	MeshData screenQuad;
 	Shader screenQuadShader;
 	ComputeShader rtCompute;
+	ComputeShader persistentCompute; // Megakernel built with PERSISTENT_THREADS
+
+	// Wavefront path tracing kernels, all built from RTCompute.comp
+	ComputeShader wavefrontGenerate;
+	ComputeShader wavefrontDispatch;
+	ComputeShader wavefrontExtend;
+	ComputeShader wavefrontShade;
+	ComputeShader wavefrontAccumulate;
 
 	GLFWwindow* window;
 	unsigned int SCR_WIDTH, SCR_HEIGHT, SCR_X_POS, SCR_Y_POS, accumulation_frame_index;
@@ -239,5 +292,14 @@ private:
 	double scrollOffsetX, scrollOffsetY;
 	bool accumulate_frames;
 	bool auto_reset_accumulation;
+	RenderDispatchMode dispatch_mode;
+	int persistent_groups; // Workgroups launched in DISPATCH_PERSISTENT, enough to fill the GPU
+	bool next_event_estimation;
+	bool multiple_importance_sampling;
+	bool russian_roulette;
+	int russian_roulette_depth; // Bounces every path makes before roulette applies
+	bool path_statistics;
+	PathStatistics frame_path_statistics; // Read back after each frame while path_statistics is enabled
+	unsigned int wavefront_capacity; // Pixels the wavefront queues are sized for
 	static bool mouseIsFree;
 };
\ No newline at end of file
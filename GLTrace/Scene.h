@@ -1,19 +1,22 @@
 #pragma once
 #include <vector>
+#include <cstring>
+#include <glm/gtc/constants.hpp>
 #include "Shader.h"
 #include "TextureLoader.h"
 #include "Hittables.h"
-#include "BVH.h"
+#include "TLAS.h"
 #include <unordered_map>
 #include "ModelLoader.h"
 static const int MAX_SPHERES = 1000000;
 static const int MAX_QUADS = 1000000;
 static const int MAX_MATERIALS = 24;
+static const int MATERIAL_TEXTURE_SLOT = 7; // Texture unit of the first material set's texture array
 
 class Scene {
 	friend class JSON;
 public:
-	Scene(const std::string& name) : scene_name(name) {
+	Scene(const std::string& name) : lightPower(0.0f), scene_name(name) {
 		spheres.reserve(MAX_SPHERES);
 		quads.reserve(MAX_QUADS);
 		materials.reserve(MAX_MATERIALS);
@@ -38,6 +41,7 @@ public:
 			shader.setInt("materials[" + i_string + "].material_set_index", materials[i].material_set_index);
 			shader.setBool("materials[" + i_string + "].is_constant_medium", materials[i].is_constant_medium);
 			shader.setFloat("materials[" + i_string + "].neg_inv_density", materials[i].neg_inv_density);
+			shader.setFloat("materials[" + i_string + "].light_density", lightPower > 0.0f ? GetEmittedLuminance(materials[i]) / lightPower : 0.0f);
 		}
 
 		// Set material sets
@@ -58,8 +62,8 @@ public:
 		for (Quad& quad : quads) {
 			quad.Recalculate(transformBuffer[quad.Normal.w]);
 		}
-		BuildBVH();
-		//RefitBVH();
+		UpdateBVH();
+		UpdateTLAS();
 	}
 
 	Camera* GetSceneCamera() { return &sceneCamera; }
@@ -68,6 +72,8 @@ public:
 	const std::vector<glm::mat4>& GetTransforms() const { return transformBuffer; }
 	const std::string& GetSphereName(const unsigned int index) const { return sphere_names[index]; }
 	const std::string& GetQuadName(const unsigned int index) const { return quad_names[index]; }
+	const std::string& GetMeshName(const unsigned int index) const { return mesh_names[index]; }
+	const std::string& GetMeshInstanceName(const unsigned int index) const { return instance_names[index]; }
 	Sphere* GetSphere(const unsigned int index) { if (index < spheres.size()) { return &spheres[index]; } else { Logger::LogError("Sphere index out of bounds"); return nullptr; } }
 	Quad* GetQuad(const unsigned int index) { if (index < quads.size()) { return &quads[index]; } else { Logger::LogError("Quad index out of bounds"); return nullptr; } }
 	glm::mat4* GetTransform(const unsigned int index) { if (index < transformBuffer.size()) { return &transformBuffer[index]; } else { Logger::LogError("Transform index out of bounds"); return nullptr; } }
@@ -78,6 +84,7 @@ public:
 	const std::vector<MaterialSet>& GetMaterialSets() const { return material_sets; }
 
 	const BVH& GetBVH() const { return bvh; }
+	const TLAS& GetTLAS() const { return tlas; }
 
 	glm::mat4* GetSphereTransform(const unsigned int sphereID) {
 		if (sphereID < spheres.size()) {
@@ -99,44 +106,127 @@ public:
 		return nullptr;
 	}
 
-	void BuildBVH() { bvh.BuildBVH(quads, spheres, transformBuffer); }
+	glm::mat4* GetMeshInstanceTransform(const unsigned int instanceID) {
+		if (instanceID < tlas.GetInstances().size()) {
+			const unsigned int transformID = tlas.GetInstances()[instanceID].transformID;
+			if (transformID < transformBuffer.size()) {
+				return &transformBuffer[transformID];
+			}
+		}
+		return nullptr;
+	}
+
+	// Loads the BVH from the scene's cache file when it matches, otherwise builds it and rewrites the cache
+	void BuildBVH() {
+		const unsigned long long cacheKey = bvhCachePath.empty() ? 0 : bvh.GetCacheKey(quads, spheres, transformBuffer);
+		if (!bvhCachePath.empty() && bvh.LoadCache(bvhCachePath.c_str(), cacheKey, quads, spheres, transformBuffer)) {
+			Logger::Log(std::string("BVH loaded from '" + bvhCachePath + "'").c_str());
+		}
+		else {
+			bvh.BuildBVH(quads, spheres, transformBuffer);
+			if (bvh.GetBuildSettings().optimisationPasses > 0) {
+				const BVHOptimisationStats& stats = bvh.GetOptimisationStats();
+				Logger::Log(std::string("BVH optimised in " + std::to_string(stats.milliseconds) + "ms over " + std::to_string(stats.passes) + " passes, SAH cost " + std::to_string(stats.sahBefore) + " -> " + std::to_string(stats.sahAfter)).c_str());
+			}
+			if (!bvhCachePath.empty()) { bvh.SaveCache(bvhCachePath.c_str(), cacheKey); }
+		}
+		tlas.BuildTLAS(transformBuffer);
+	}
+	// Empty to disable caching
+	void SetBVHCachePath(const std::string& path) { bvhCachePath = path; }
+	void SetBVHBuildMethod(const BVHBuildMethod method) { bvh.SetBuildMethod(method); }
+	// Extra references an SBVH build may create, as a fraction of the primitive count
+	void SetBVHSpatialSplitBudget(const float budget) { bvh.SetSpatialSplitBudget(budget); }
+	void SetBVHBuildQuality(const BVHBuildQuality quality) {
+		const BVHBuildSettings previous = bvh.GetBuildSettings();
+		bvh.SetBuildQuality(quality);
+		BVHBuildSettings settings = bvh.GetBuildSettings();
+		settings.optimisationPasses = previous.optimisationPasses;
+		settings.compressWideBVH = previous.compressWideBVH;
+		bvh.SetBuildSettings(settings);
+	}
+	// Takes effect on the next refit or build
+	void SetBVHCompressWideBVH(const bool compress) {
+		BVHBuildSettings settings = bvh.GetBuildSettings();
+		settings.compressWideBVH = compress;
+		bvh.SetBuildSettings(settings);
+	}
+	// Treelet optimisation passes run after each BVH build, intended for static scenes
+	void SetBVHOptimisationPasses(const unsigned int passes) {
+		BVHBuildSettings settings = bvh.GetBuildSettings();
+		settings.optimisationPasses = passes;
+		bvh.SetBuildSettings(settings);
+	}
 	void RefitBVH() { bvh.RefitBVH(quads, spheres, transformBuffer); }
-	void BufferBVH(ComputeShader& computeShader) const { bvh.Buffer(computeShader); }
+	void UpdateBVH() { bvh.UpdateBVH(quads, spheres, transformBuffer); }
+	void UpdateTLAS() { tlas.UpdateTLAS(transformBuffer); }
+	void BufferBVH(ComputeShader& computeShader) const {
+		bvh.Buffer(computeShader);
+		tlas.Buffer(computeShader);
+	}
 	void BufferSceneHittables(ComputeShader& computeShader) const {
 		const ShaderStorageBuffer* sphereSSBO = computeShader.GetSSBO(4);
 		const ShaderStorageBuffer* quadSSBO = computeShader.GetSSBO(5);
 		const ShaderStorageBuffer* transformSSBO = computeShader.GetSSBO(6);
-		const unsigned int num_spheres = spheres.size();
-		const unsigned int num_quads = quads.size();
+		const ShaderStorageBuffer* lightSSBO = computeShader.GetSSBO(3);
+
+		UpdateGPUTransforms();
+		UpdateWorldQuads();
+
+		// Upload in BVH leaf order when the BVH expects it, scene order is left untouched for the editor
+		const std::vector<Sphere>* gpuSpheres = &spheres;
+		const std::vector<Quad>* gpuQuads = &worldQuads;
+		const bool leafOrder = bvh.GetBuildSettings().reorderPrimitives;
+		if (leafOrder) {
+			BVH::PermuteToLeafOrder(spheres, bvh.GetPrimitiveRefs(), BVH_PRIMITIVE_SPHERE, leafOrderSpheres, &leafOrderSphereIndices);
+			BVH::PermuteToLeafOrder(worldQuads, bvh.GetPrimitiveRefs(), BVH_PRIMITIVE_QUAD, leafOrderQuads, &leafOrderQuadIndices);
+			gpuSpheres = &leafOrderSpheres;
+			gpuQuads = &leafOrderQuads;
+		}
+		UpdateLights(leafOrder ? &leafOrderSphereIndices : nullptr, leafOrder ? &leafOrderQuadIndices : nullptr);
+
+		const unsigned int num_spheres = gpuSpheres->size();
+		const unsigned int num_quads = gpuQuads->size();
 		const unsigned int num_transforms = transformBuffer.size();
+		const unsigned int num_lights = lights.size();
 
 		// Buffer spheres
 		// --------------
 		// Initialise buffer
-		sphereSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Sphere) * spheres.size()), GL_STATIC_DRAW);
+		sphereSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Sphere) * num_spheres), GL_STATIC_DRAW);
 		// Buffer data
 		sphereSSBO->BufferSubData(&num_spheres, sizeof(unsigned int), 0);
 		if (num_spheres > 0) {
-			sphereSSBO->BufferSubData(&spheres[0], sizeof(Sphere) * num_spheres, sizeof(unsigned int) * 4);
+			sphereSSBO->BufferSubData(&(*gpuSpheres)[0], sizeof(Sphere) * num_spheres, sizeof(unsigned int) * 4);
 		}
 
 		// Buffer quads
 		// ------------
 		// Initialise buffer
-		quadSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Quad) * quads.size()), GL_STATIC_DRAW);
+		quadSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Quad) * num_quads), GL_STATIC_DRAW);
 		// Buffer data
 		quadSSBO->BufferSubData(&num_quads, sizeof(unsigned int), 0);
 		if (num_quads > 0) {
-			quadSSBO->BufferSubData(&quads[0], sizeof(Quad) * num_quads, sizeof(unsigned int) * 4);
+			quadSSBO->BufferSubData(&(*gpuQuads)[0], sizeof(Quad) * num_quads, sizeof(unsigned int) * 4);
 		}
 
 		// Buffer transforms
 		// -----------------
 		// Initialise buffer
-		transformSSBO->BufferData(nullptr, (sizeof(glm::mat4) * num_transforms), GL_STATIC_COPY);
+		transformSSBO->BufferData(nullptr, (sizeof(GPUTransform) * num_transforms), GL_STATIC_COPY);
 		// Buffer data
 		if (num_transforms > 0) {
-			transformSSBO->BufferData(&transformBuffer[0], sizeof(glm::mat4) * num_transforms, GL_STATIC_COPY);
+			transformSSBO->BufferData(&gpuTransforms[0], sizeof(GPUTransform) * num_transforms, GL_STATIC_COPY);
+		}
+
+		// Buffer lights
+		// -------------
+		// Initialise buffer
+		lightSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Light) * num_lights), GL_STATIC_DRAW);
+		// Buffer data
+		lightSSBO->BufferSubData(&num_lights, sizeof(unsigned int), 0);
+		if (num_lights > 0) {
+			lightSSBO->BufferSubData(&lights[0], sizeof(Light) * num_lights, sizeof(unsigned int) * 4);
 		}
 	}
 
@@ -144,15 +234,16 @@ public:
 		const ShaderStorageBuffer* sphereSSBO = computeShader.GetSSBO(4);
 		const ShaderStorageBuffer* quadSSBO = computeShader.GetSSBO(5);
 		const ShaderStorageBuffer* transformSSBO = computeShader.GetSSBO(6);
-		const unsigned int num_spheres = spheres.size();
-		const unsigned int num_quads = quads.size();
+		const ShaderStorageBuffer* lightSSBO = computeShader.GetSSBO(3);
 		const unsigned int num_transforms = transformBuffer.size();
 
 		sphereSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Sphere) * spheres.size()), GL_STATIC_DRAW);
 		quadSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Quad) * quads.size()), GL_STATIC_DRAW);
-		transformSSBO->BufferData(nullptr, (sizeof(glm::mat4) * num_transforms), GL_STATIC_COPY);
+		transformSSBO->BufferData(nullptr, (sizeof(GPUTransform) * num_transforms), GL_STATIC_COPY);
+		lightSSBO->BufferData(nullptr, (sizeof(unsigned int) * 4) + (sizeof(Light) * lights.size()), GL_STATIC_DRAW);
 
 		bvh.ClearBuffer(computeShader);
+		tlas.ClearBuffer(computeShader);
 	}
 
 	Sphere* AddSphere(const std::string& name, const glm::vec3& position, const float radius, const unsigned int material_index) {
@@ -164,10 +255,12 @@ public:
 				sphere_map[name] = num_spheres;
 				transformBuffer.insert(transformBuffer.begin() + num_spheres, glm::mat4(1.0f));
 
-				// Increment quad transform pointers
+				// Increment quad and mesh instance transform pointers
 				for (Quad& quad : quads) {
 					quad.Normal.w++;
 				}
+				tlas.OffsetTransformIDs(num_spheres, 1);
+				bvh.InsertPrimitive(BVH_PRIMITIVE_SPHERE, num_spheres, quads, spheres, transformBuffer);
 			}
 			else {
 				Logger::LogWarning("Maximum sphere count reached");
@@ -187,6 +280,7 @@ public:
 				quad_names.push_back(name);
 				quad_map[name] = quads.size() - 1;
 				transformBuffer.push_back(glm::mat4(1.0f));
+				bvh.InsertPrimitive(BVH_PRIMITIVE_QUAD, quads.size() - 1, quads, spheres, transformBuffer);
 			}
 			else {
 				Logger::LogWarning("Maximum quad count reached");
@@ -206,6 +300,7 @@ public:
 				quad_names.push_back(name);
 				quad_map[name] = quads.size() - 1;
 				transformBuffer.push_back(glm::mat4(1.0f));
+				bvh.InsertPrimitive(BVH_PRIMITIVE_QUAD, quads.size() - 1, quads, spheres, transformBuffer);
 			}
 			else {
 				Logger::LogWarning("Maximum quad count reached");
@@ -225,6 +320,7 @@ public:
 				quad_names.push_back(name);
 				quad_map[name] = quads.size() - 1;
 				transformBuffer.push_back(glm::mat4(1.0f));
+				bvh.InsertPrimitive(BVH_PRIMITIVE_QUAD, quads.size() - 1, quads, spheres, transformBuffer);
 			}
 			else {
 				Logger::LogWarning("Maximum quad count reached");
@@ -258,49 +354,72 @@ public:
 		return sides;
 	}
 
+	// Loads each mesh of a model as its own instanced mesh, placed with one instance per mesh that shares the mesh's name
 	const bool LoadModelAsTriangles(const char* filepath, const unsigned int material_index = 0) {
 		std::vector<Mesh> meshes;
 		if (ModelLoader::LoadModelFromFile(meshes, filepath)) {
-			unsigned int totalVertices = 0;
+			unsigned int totalTriangles = 0;
 			for (const Mesh& mesh : meshes) {
-				const std::vector<glm::vec4>& vertices = mesh.vertices;
-				const std::vector<unsigned int>& indices = mesh.indices;
-				totalVertices += indices.size();
+				std::vector<Quad> triangles;
+				AppendMeshTriangles(mesh, material_index, triangles);
+				if (triangles.empty()) { continue; }
 
-				transformBuffer.push_back(glm::mat4(1.0f));
-
-				unsigned triangle_index = 0;
-				for (int i = 0; i < indices.size() - 3; i += 3) {
-					triangle_index++;
-					const glm::vec4 Q = vertices[indices[i]];
-					const glm::vec4 U = vertices[indices[i + 1]] - Q;
-					const glm::vec4 V = vertices[indices[i + 2]] - Q;
-
-					std::string name = mesh.name + "/triangle" + std::to_string(triangle_index);
-					if (quad_map.find(name) == quad_map.end()) {
-						if (quads.size() < MAX_QUADS) {
-							quads.push_back(Quad(TRIANGLE, Q, U, V, transformBuffer.size() - 1, material_index));
-							quad_names.push_back(name);
-							quad_map[name] = quads.size() - 1;
-						}
-						else {
-							Logger::LogWarning("Maximum quad count reached");
-							return false;
-						}
-					}
-					else {
-						Logger::LogError("Quad name already exists");
-						return false;
-					}
+				if (!AddMesh(mesh.name, triangles) || !AddMeshInstance(mesh.name, mesh.name)) {
+					return false;
 				}
+				totalTriangles += triangles.size();
 			}
-			Logger::Log(std::string("Vertex count = " + std::to_string(totalVertices)).c_str());
-			Logger::Log(std::string("Triangle count = " + std::to_string(totalVertices / 3)).c_str());
+			Logger::Log(std::string("Vertex count = " + std::to_string(totalTriangles * 3)).c_str());
+			Logger::Log(std::string("Triangle count = " + std::to_string(totalTriangles)).c_str());
 			return true;
 		}
 		return false;
 	}
 
+	// Loads every triangle of a model into a single object space mesh that can be instanced any number of times with AddMeshInstance
+	const bool LoadModelAsMesh(const std::string& name, const char* filepath, const unsigned int material_index = 0) {
+		std::vector<Mesh> meshes;
+		if (ModelLoader::LoadModelFromFile(meshes, filepath)) {
+			std::vector<Quad> triangles;
+			for (const Mesh& mesh : meshes) {
+				AppendMeshTriangles(mesh, material_index, triangles);
+			}
+			return AddMesh(name, triangles);
+		}
+		return false;
+	}
+	// Triangles are given in object space, the mesh is only visible once instanced with AddMeshInstance
+	bool AddMesh(const std::string& name, const std::vector<Quad>& triangles) {
+		if (mesh_map.find(name) != mesh_map.end()) {
+			Logger::LogError("Mesh name already exists");
+			return false;
+		}
+		if (triangles.empty()) {
+			Logger::LogWarning("Mesh contains no triangles");
+			return false;
+		}
+
+		mesh_map[name] = tlas.AddMesh(triangles);
+		mesh_names.push_back(name);
+		Logger::Log(std::string("Mesh triangle count = " + std::to_string(triangles.size())).c_str());
+		return true;
+	}
+	glm::mat4* AddMeshInstance(const std::string& name, const std::string& meshName, const glm::mat4& transform = glm::mat4(1.0f)) {
+		if (mesh_map.find(meshName) == mesh_map.end()) {
+			Logger::LogError("Mesh does not exist");
+			return nullptr;
+		}
+		if (instance_map.find(name) != instance_map.end()) {
+			Logger::LogError("Mesh instance name already exists");
+			return nullptr;
+		}
+
+		transformBuffer.push_back(transform);
+		instance_map[name] = tlas.AddInstance(mesh_map[meshName], transformBuffer.size() - 1);
+		instance_names.push_back(name);
+		return &transformBuffer.back();
+	}
+
 	void RemoveSphere(const unsigned int sphereIndex) {
 		if (sphereIndex < spheres.size()) {
 			const unsigned int transformID = spheres[sphereIndex].GetTransformID();
@@ -317,6 +436,8 @@ public:
 			for (Quad& quad : quads) {
 				quad.Normal.w--;
 			}
+			tlas.OffsetTransformIDs(transformID + 1, -1);
+			bvh.RemovePrimitive(BVH_PRIMITIVE_SPHERE, sphereIndex, quads, spheres);
 		}
 	}
 	void RemoveQuad(const unsigned int quadIndex) {
@@ -332,6 +453,25 @@ public:
 			for (int i = quadIndex; i < quads.size(); i++) {
 				quads[i].Normal.w--;
 			}
+			tlas.OffsetTransformIDs(transformID + 1, -1);
+			bvh.RemovePrimitive(BVH_PRIMITIVE_QUAD, quadIndex, quads, spheres);
+		}
+	}
+
+	void RemoveMeshInstance(const unsigned int instanceIndex) {
+		if (instanceIndex < tlas.GetInstances().size()) {
+			const unsigned int transformID = tlas.GetInstances()[instanceIndex].transformID;
+			const std::string instanceName = instance_names[instanceIndex];
+			instance_names.erase(instance_names.begin() + instanceIndex);
+			instance_map.erase(instanceName);
+			tlas.RemoveInstance(instanceIndex);
+			transformBuffer.erase(transformBuffer.begin() + transformID);
+
+			// decrement quad and mesh instance transform pointers after the erased transform, spheres always come first
+			for (Quad& quad : quads) {
+				if (quad.Normal.w > transformID) { quad.Normal.w--; }
+			}
+			tlas.OffsetTransformIDs(transformID + 1, -1);
 		}
 	}
 
@@ -372,6 +512,18 @@ protected:
 			stringPaths.push_back(filepaths[i]);
 		}
 		texture_sets.push_back(std::make_pair(stringPaths, bindSlot));
+		texture_set_averages[bindSlot] = maps->GetLayerAverages();
+	}
+
+	static void AppendMeshTriangles(const Mesh& mesh, const unsigned int material_index, std::vector<Quad>& triangles) {
+		const std::vector<glm::vec4>& vertices = mesh.vertices;
+		const std::vector<unsigned int>& indices = mesh.indices;
+		for (int i = 0; i + 2 < indices.size(); i += 3) {
+			const glm::vec4 Q = vertices[indices[i]];
+			const glm::vec4 U = vertices[indices[i + 1]] - Q;
+			const glm::vec4 V = vertices[indices[i + 2]] - Q;
+			triangles.push_back(Quad(TRIANGLE, Q, U, V, 0, material_index));
+		}
 	}
 
 	void ClearQuadList() { quads.clear(); }
@@ -379,6 +531,106 @@ protected:
 
 	Camera sceneCamera;
 private:
+	void UpdateGPUTransforms() const {
+		const unsigned int num_transforms = transformBuffer.size();
+		gpuTransformSources.resize(num_transforms, glm::mat4(0.0f));
+		gpuTransforms.resize(num_transforms);
+		transformsChanged.assign(num_transforms, false);
+		for (unsigned int i = 0; i < num_transforms; i++) {
+			if (gpuTransformSources[i] != transformBuffer[i]) {
+				gpuTransformSources[i] = transformBuffer[i];
+				gpuTransforms[i] = GPUTransform(transformBuffer[i]);
+				transformsChanged[i] = true;
+			}
+		}
+	}
+	// Rebakes quads whose transform changed since the last upload or that were edited themselves, expects UpdateGPUTransforms to have run first
+	void UpdateWorldQuads() const {
+		const unsigned int num_quads = quads.size();
+		const Quad empty(QUAD, glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 0u);
+		worldQuadSources.resize(num_quads, empty);
+		worldQuads.resize(num_quads, empty);
+		for (unsigned int i = 0; i < num_quads; i++) {
+			const unsigned int transformID = quads[i].Normal.w;
+			if (transformsChanged[transformID] || std::memcmp(&worldQuadSources[i], &quads[i], sizeof(Quad)) != 0) {
+				worldQuadSources[i] = quads[i];
+				worldQuads[i] = quads[i].WorldSpace(transformBuffer[transformID]);
+			}
+		}
+	}
+	// Emitted radiance used to weight a light, the shader adds the albedo to the emission on a light hit
+	float GetEmittedLuminance(const Material& mat) const {
+		const glm::vec3 luminanceWeights = glm::vec3(0.2126f, 0.7152f, 0.0722f);
+		if (mat.EmissivePower <= 0.0f || mat.is_constant_medium) { return 0.0f; }
+
+		// Textured emitters are weighted by the mean texel of their emission layer, an unloaded layer samples as black
+		glm::vec3 emission = mat.EmissiveColour;
+		const bool emissionTextured = mat.material_set_index > -1 && material_sets[mat.material_set_index].emission_index > -1;
+		if (emissionTextured) {
+			emission = glm::vec3(0.0f);
+			const unsigned int emissionLayer = material_sets[mat.material_set_index].emission_index;
+			std::unordered_map<unsigned int, std::vector<glm::vec3>>::const_iterator averagesIt = texture_set_averages.find(mat.material_set_index + MATERIAL_TEXTURE_SLOT);
+			if (averagesIt != texture_set_averages.end() && emissionLayer < averagesIt->second.size()) { emission = averagesIt->second[emissionLayer]; }
+		}
+		if (emission == glm::vec3(0.0f)) { return 0.0f; }
+		return glm::dot(emission * mat.EmissivePower + mat.Albedo, luminanceWeights);
+	}
+	// Rebuilds the light list with one light per emissive sphere and quad, each picked with probability proportional to power x area
+	// Spatial splits can upload a primitive more than once, its light points at the first uploaded copy given by the index maps, null for scene order
+	void UpdateLights(const std::vector<unsigned int>* sphereUploadIndices, const std::vector<unsigned int>* quadUploadIndices) const {
+		lights.clear();
+		lightPower = 0.0f;
+		for (unsigned int i = 0; i < spheres.size(); i++) {
+			const unsigned int uploadIndex = sphereUploadIndices ? (*sphereUploadIndices)[i] : i;
+			if (uploadIndex == BVH_UNREFERENCED_PRIMITIVE) { continue; }
+			const float luminance = GetEmittedLuminance(materials[spheres[i].material_index]);
+			if (luminance <= 0.0f) { continue; }
+
+			// Scale taken as uniform, from the volume change of the transform
+			const float scale = std::cbrt(std::abs(glm::determinant(glm::mat3(transformBuffer[spheres[i].GetTransformID()]))));
+			const float radius = spheres[i].Radius * scale;
+			const float area = 4.0f * glm::pi<float>() * radius * radius;
+			lights.push_back(Light(BVHPrimitiveRef::Make(BVH_PRIMITIVE_SPHERE, uploadIndex), luminance * area, area));
+			lightPower += luminance * area;
+		}
+		for (unsigned int i = 0; i < worldQuads.size(); i++) {
+			const unsigned int uploadIndex = quadUploadIndices ? (*quadUploadIndices)[i] : i;
+			if (uploadIndex == BVH_UNREFERENCED_PRIMITIVE) { continue; }
+			const float luminance = GetEmittedLuminance(materials[worldQuads[i].material_index]);
+			if (luminance <= 0.0f) { continue; }
+
+			// Area is the parallelogram spanned by U and V
+			float area = worldQuads[i].GetArea();
+			if (worldQuads[i].triangle_disk_id == 1u) { area *= 0.5f; }
+			else if (worldQuads[i].triangle_disk_id == 2u) { area *= glm::pi<float>(); }
+			lights.push_back(Light(BVHPrimitiveRef::Make(BVH_PRIMITIVE_QUAD, uploadIndex), luminance * area, area));
+			lightPower += luminance * area;
+		}
+
+		float cdf = 0.0f;
+		for (Light& light : lights) {
+			light.probability /= lightPower;
+			cdf += light.probability;
+			light.cdf = cdf;
+		}
+		if (!lights.empty()) { lights.back().cdf = 1.0f; }
+		if (!LightsCoverEmittersOnce()) { Logger::LogError("Light list does not cover each emitter exactly once"); }
+	}
+	// True if no uploaded primitive has more than one light and the selection probabilities sum to one
+	bool LightsCoverEmittersOnce() const {
+		if (lights.empty()) { return true; }
+
+		lightRefs.clear();
+		float probabilitySum = 0.0f;
+		for (const Light& light : lights) {
+			lightRefs.push_back(light.primitiveRef);
+			probabilitySum += light.probability;
+		}
+		std::sort(lightRefs.begin(), lightRefs.end());
+		const bool unique = std::adjacent_find(lightRefs.begin(), lightRefs.end()) == lightRefs.end();
+		return unique && std::abs(probabilitySum - 1.0f) < 1e-3f;
+	}
+
 	std::unordered_map<std::string, unsigned int> sphere_map;
 	std::vector<std::string> sphere_names;
 	std::vector<Sphere> spheres;
@@ -392,11 +644,39 @@ private:
 	std::vector<Material> materials;
 
 	std::vector<std::pair<std::vector<std::string>, unsigned int>> texture_sets;
+	std::unordered_map<unsigned int, std::vector<glm::vec3>> texture_set_averages; // Per layer mean colour, keyed by bind slot
 	std::vector<MaterialSet> material_sets;
 
+	std::unordered_map<std::string, unsigned int> mesh_map;
+	std::vector<std::string> mesh_names;
+	std::unordered_map<std::string, unsigned int> instance_map;
+	std::vector<std::string> instance_names;
+
 	std::vector<glm::mat4> transformBuffer;
 
+	// BVH leaf order copies uploaded in place of spheres and quads, kept to reuse their allocations
+	mutable std::vector<Sphere> leafOrderSpheres;
+	mutable std::vector<Quad> leafOrderQuads;
+	mutable std::vector<unsigned int> leafOrderSphereIndices; // First leaf order copy of each scene sphere and quad, where their light points
+	mutable std::vector<unsigned int> leafOrderQuadIndices;
+
+	// Forward and inverse transforms uploaded in place of transformBuffer, only recomputed where the matrix has changed since the last upload
+	mutable std::vector<glm::mat4> gpuTransformSources;
+	mutable std::vector<GPUTransform> gpuTransforms;
+	mutable std::vector<bool> transformsChanged;
+
+	// Quads with vertices and plane data baked into world space, the shader tests them without a transform
+	mutable std::vector<Quad> worldQuadSources;
+	mutable std::vector<Quad> worldQuads;
+
+	// One per emissive sphere and quad, referencing the uploaded buffers
+	mutable std::vector<Light> lights;
+	mutable std::vector<unsigned int> lightRefs; // Scratch for LightsCoverEmittersOnce
+	mutable float lightPower; // Sum of power x area over the light list, a light's pdf per unit area is its material's power over this
+
 	std::string scene_name;
+	std::string bvhCachePath;
 
 	BVH bvh;
+	TLAS tlas;
 };
\ No newline at end of file
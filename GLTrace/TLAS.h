@@ -0,0 +1,292 @@
+#pragma once
+#include "BVH.h"
+
+// Geometry shared by every instance of a mesh, stored once in object space with its own bottom level BVH
+struct BLASMesh {
+	BVH blas;
+	unsigned int blasRoot = 0;		// Root node index in the combined BLAS node buffer
+	unsigned int firstQuad = 0;		// Object space quads in the combined mesh quad buffer
+	unsigned int quadCount = 0;
+};
+
+struct MeshInstance {
+	unsigned int meshID;
+	unsigned int transformID; // Index into the scene transform buffer
+};
+
+// Instance as seen by the shader, stored in top level leaf order
+struct GPUMeshInstance {
+	unsigned int blasRoot;
+	unsigned int transformID;
+	unsigned int padding1, padding2;
+};
+
+// Two level acceleration structure for instanced meshes
+// Each mesh has a bottom level BVH built once in object space, the top level BVH is built over the world bounds of every instance
+// Moving an instance only changes its transform so only the (small) top level needs rebuilding
+// Top level leaves store their instance range in the primitive range of BVHNode
+class TLAS {
+public:
+	TLAS() : blasBufferDirty(true), nodesUsed(0) {}
+	~TLAS() {}
+
+	unsigned int AddMesh(const std::vector<Quad>& objectSpaceQuads) {
+		const unsigned int meshID = meshes.size();
+		meshes.push_back(BLASMesh());
+		BLASMesh& mesh = meshes.back();
+
+		// Transform ID 0 refers to the identity so plane data stays in object space
+		std::vector<Quad> quads = objectSpaceQuads;
+		for (Quad& quad : quads) {
+			quad.Normal.a = 0.0f;
+			quad.Recalculate(glm::mat4(1.0f));
+		}
+
+		const std::vector<glm::mat4> objectTransform = { glm::mat4(1.0f) };
+		BVHBuildSettings settings = BVHBuildSettings::FromQuality(BVH_QUALITY_HIGH);
+		settings.wideBVH = false; // BLASes are traversed as binary trees
+		mesh.blas.SetBuildSettings(settings);
+		mesh.blas.BuildBVH(quads, std::vector<Sphere>(), objectTransform);
+
+		// Append to the combined buffers with quads in leaf order, offsetting child and primitive indices
+		const unsigned int nodeOffset = blasNodes.size();
+		const unsigned int quadOffset = blasQuads.size();
+		const std::vector<BVHNode>& tree = mesh.blas.GetTree();
+		for (unsigned int i = 0; i <= mesh.blas.GetNodesUsed(); i++) {
+			BVHNode node = tree[i];
+			if (node.isLeaf()) { node.firstPrimitive += quadOffset; }
+			else if (node.leftChild != 0) { node.leftChild += nodeOffset; }
+			blasNodes.push_back(node);
+		}
+		std::vector<Quad> leafOrderQuads;
+		BVH::PermuteToLeafOrder(quads, mesh.blas.GetPrimitiveRefs(), BVH_PRIMITIVE_QUAD, leafOrderQuads);
+		blasQuads.insert(blasQuads.end(), leafOrderQuads.begin(), leafOrderQuads.end());
+
+		mesh.blasRoot = nodeOffset;
+		mesh.firstQuad = quadOffset;
+		mesh.quadCount = leafOrderQuads.size();
+		blasBufferDirty = true;
+		return meshID;
+	}
+
+	unsigned int AddInstance(const unsigned int meshID, const unsigned int transformID) {
+		MeshInstance instance;
+		instance.meshID = meshID;
+		instance.transformID = transformID;
+		instances.push_back(instance);
+		return instances.size() - 1;
+	}
+
+	// Leaves the mesh in place, UpdateTLAS rebuilds the top level for the remaining instances
+	void RemoveInstance(const unsigned int instanceID) {
+		if (instanceID < instances.size()) {
+			instances.erase(instances.begin() + instanceID);
+		}
+	}
+
+	void SetInstanceTransformID(const unsigned int instanceID, const unsigned int transformID) {
+		if (instanceID < instances.size()) {
+			instances[instanceID].transformID = transformID;
+		}
+	}
+
+	// Shifts every instance transform ID at or after firstTransformID, used when the scene inserts or erases transforms
+	void OffsetTransformIDs(const unsigned int firstTransformID, const int offset) {
+		for (MeshInstance& instance : instances) {
+			if (instance.transformID >= firstTransformID) { instance.transformID += offset; }
+		}
+	}
+
+	// Recalculates instance bounds and rebuilds the top level only if any of them moved
+	bool UpdateTLAS(const std::vector<glm::mat4>& transformBuffer) {
+		if (instances.size() != instanceBounds.size()) {
+			BuildTLAS(transformBuffer);
+			return true;
+		}
+
+		bool changed = false;
+		for (unsigned int i = 0; i < instances.size(); i++) {
+			const aabb bounds = GetInstanceBounds(instances[i], transformBuffer);
+			if (bounds.aabbMin != instanceBounds[i].aabbMin || bounds.aabbMax != instanceBounds[i].aabbMax) {
+				changed = true;
+				break;
+			}
+		}
+		if (changed) { BuildTLAS(transformBuffer); }
+		return changed;
+	}
+
+	void BuildTLAS(const std::vector<glm::mat4>& transformBuffer) {
+		const unsigned int instanceCount = instances.size();
+		instanceBounds.resize(instanceCount);
+		instanceOrder.resize(instanceCount);
+		for (unsigned int i = 0; i < instanceCount; i++) {
+			instanceBounds[i] = GetInstanceBounds(instances[i], transformBuffer);
+			instanceOrder[i] = i;
+		}
+
+		tree.clear();
+		nodesUsed = 0;
+		if (instanceCount > 0) {
+			tree.resize(instanceCount * 2 - 1);
+			tree[0].firstPrimitive = 0;
+			tree[0].primitiveCount = instanceCount;
+			nodesUsed = 1;
+			Subdivide(0);
+		}
+
+		// Store instances in leaf order so leaves index them directly
+		gpuInstances.resize(instanceCount);
+		for (unsigned int i = 0; i < instanceCount; i++) {
+			const MeshInstance& instance = instances[instanceOrder[i]];
+			gpuInstances[i].blasRoot = meshes[instance.meshID].blasRoot;
+			gpuInstances[i].transformID = instance.transformID;
+			gpuInstances[i].padding1 = 0;
+			gpuInstances[i].padding2 = 0;
+		}
+	}
+
+	void Buffer(ComputeShader& computeShader) const {
+		const ShaderStorageBuffer* tlasSSBO = computeShader.GetSSBO(7);
+		const ShaderStorageBuffer* instanceSSBO = computeShader.GetSSBO(8);
+		const unsigned int instanceCount = gpuInstances.size();
+
+		// TLAS buffer
+		// -----------
+		tlasSSBO->BufferData(nullptr, (sizeof(BVHNode) * std::max(1u, nodesUsed)) + (sizeof(unsigned int) * 4), GL_STREAM_COPY);
+		tlasSSBO->BufferSubData(&instanceCount, sizeof(unsigned int), 0);
+		tlasSSBO->BufferSubData(&nodesUsed, sizeof(unsigned int), sizeof(unsigned int));
+		if (nodesUsed > 0) {
+			tlasSSBO->BufferSubData(&tree[0], sizeof(BVHNode) * nodesUsed, sizeof(unsigned int) * 4);
+		}
+
+		// Instance buffer
+		// ---------------
+		instanceSSBO->BufferData(nullptr, sizeof(GPUMeshInstance) * std::max(1u, instanceCount), GL_STREAM_COPY);
+		if (instanceCount > 0) {
+			instanceSSBO->BufferSubData(&gpuInstances[0], sizeof(GPUMeshInstance) * instanceCount, 0);
+		}
+
+		// Mesh geometry never changes once added, only upload it when a mesh is added
+		if (blasBufferDirty) {
+			BufferBLAS(computeShader);
+			blasBufferDirty = false;
+		}
+	}
+	void ClearBuffer(ComputeShader& computeShader) const {
+		computeShader.GetSSBO(7)->BufferData(nullptr, (sizeof(BVHNode) * std::max(1u, nodesUsed)) + (sizeof(unsigned int) * 4), GL_STREAM_COPY);
+		computeShader.GetSSBO(8)->BufferData(nullptr, sizeof(GPUMeshInstance) * std::max<size_t>(1, gpuInstances.size()), GL_STREAM_COPY);
+		computeShader.GetSSBO(9)->BufferData(nullptr, sizeof(BVHNode) * std::max<size_t>(1, blasNodes.size()), GL_STATIC_DRAW);
+		computeShader.GetSSBO(11)->BufferData(nullptr, sizeof(Quad) * std::max<size_t>(1, blasQuads.size()), GL_STATIC_DRAW);
+		blasBufferDirty = true;
+	}
+
+	const std::vector<BLASMesh>& GetMeshes() const { return meshes; }
+	const std::vector<MeshInstance>& GetInstances() const { return instances; }
+	// Object space triangles of a mesh in BLAS leaf order
+	std::vector<Quad> GetMeshQuads(const unsigned int meshID) const {
+		const BLASMesh& mesh = meshes[meshID];
+		return std::vector<Quad>(blasQuads.begin() + mesh.firstQuad, blasQuads.begin() + mesh.firstQuad + mesh.quadCount);
+	}
+	const std::vector<BVHNode>& GetTree() const { return tree; }
+	unsigned int GetNodesUsed() const { return nodesUsed; }
+
+private:
+	aabb GetInstanceBounds(const MeshInstance& instance, const std::vector<glm::mat4>& transformBuffer) const {
+		const aabb& objectBounds = meshes[instance.meshID].blas.GetTree()[0].bbox;
+		const glm::mat4& transform = transformBuffer[instance.transformID];
+		aabb bounds;
+		for (unsigned int i = 0; i < 8; i++) {
+			const glm::vec3 corner = glm::vec3((i & 1) ? objectBounds.aabbMax.x : objectBounds.aabbMin.x, (i & 2) ? objectBounds.aabbMax.y : objectBounds.aabbMin.y, (i & 4) ? objectBounds.aabbMax.z : objectBounds.aabbMin.z);
+			bounds.grow(glm::vec3(transform * glm::vec4(corner, 1.0f)));
+		}
+		return bounds;
+	}
+
+	// Full SAH sweep over instance centroids, instances are few so every leaf holds a single instance
+	void Subdivide(const unsigned int nodeID) {
+		BVHNode& node = tree[nodeID];
+		const unsigned int first = node.firstPrimitive;
+		const unsigned int count = node.primitiveCount;
+
+		node.bbox = aabb();
+		for (unsigned int i = first; i < first + count; i++) {
+			node.bbox.grow(instanceBounds[instanceOrder[i]]);
+		}
+		if (count == 1) { return; }
+
+		// Find best split
+		int bestAxis = 2;
+		unsigned int bestSplit = count / 2;
+		float bestCost = 1e30f;
+		std::vector<float> rightAreas(count);
+		for (int axis = 0; axis < 3; axis++) {
+			SortByCentroid(first, count, axis);
+
+			aabb rightBounds;
+			for (unsigned int i = count - 1; i > 0; i--) {
+				rightBounds.grow(instanceBounds[instanceOrder[first + i]]);
+				rightAreas[i] = rightBounds.area();
+			}
+			aabb leftBounds;
+			for (unsigned int i = 1; i < count; i++) {
+				leftBounds.grow(instanceBounds[instanceOrder[first + i - 1]]);
+				const float cost = (leftBounds.area() * i) + (rightAreas[i] * (count - i));
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i;
+				}
+			}
+		}
+		if (bestAxis != 2) { SortByCentroid(first, count, bestAxis); }
+
+		// Create child nodes
+		const unsigned int leftChildID = nodesUsed++;
+		const unsigned int rightChildID = nodesUsed++;
+		node.leftChild = leftChildID;
+		node.primitiveCount = 0;
+		tree[leftChildID].firstPrimitive = first;
+		tree[leftChildID].primitiveCount = bestSplit;
+		tree[rightChildID].firstPrimitive = first + bestSplit;
+		tree[rightChildID].primitiveCount = count - bestSplit;
+
+		Subdivide(leftChildID);
+		Subdivide(rightChildID);
+	}
+
+	void SortByCentroid(const unsigned int first, const unsigned int count, const int axis) {
+		std::sort(instanceOrder.begin() + first, instanceOrder.begin() + first + count, [&](const unsigned int a, const unsigned int b) {
+			return (instanceBounds[a].aabbMin[axis] + instanceBounds[a].aabbMax[axis]) < (instanceBounds[b].aabbMin[axis] + instanceBounds[b].aabbMax[axis]);
+		});
+	}
+
+	void BufferBLAS(ComputeShader& computeShader) const {
+		const ShaderStorageBuffer* blasSSBO = computeShader.GetSSBO(9);
+		const ShaderStorageBuffer* meshQuadSSBO = computeShader.GetSSBO(11);
+
+		blasSSBO->BufferData(nullptr, sizeof(BVHNode) * std::max<size_t>(1, blasNodes.size()), GL_STATIC_DRAW);
+		if (blasNodes.size() > 0) {
+			blasSSBO->BufferSubData(&blasNodes[0], sizeof(BVHNode) * blasNodes.size(), 0);
+		}
+
+		meshQuadSSBO->BufferData(nullptr, sizeof(Quad) * std::max<size_t>(1, blasQuads.size()), GL_STATIC_DRAW);
+		if (blasQuads.size() > 0) {
+			meshQuadSSBO->BufferSubData(&blasQuads[0], sizeof(Quad) * blasQuads.size(), 0);
+		}
+	}
+
+	// Bottom level
+	std::vector<BLASMesh> meshes;
+	std::vector<BVHNode> blasNodes;
+	std::vector<Quad> blasQuads;
+	mutable bool blasBufferDirty;
+
+	// Top level
+	std::vector<MeshInstance> instances;
+	std::vector<aabb> instanceBounds;
+	std::vector<unsigned int> instanceOrder;
+	std::vector<GPUMeshInstance> gpuInstances;
+	std::vector<BVHNode> tree;
+	unsigned int nodesUsed;
+};
\ No newline at end of file
@@ -52,7 +52,10 @@ public:
 		// Quads
 		AddQuad("Floor", glm::vec3(-100.0f, -1.2f, -100.0f), glm::vec3(200.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 200.0f), 2);
 
+		// Meshes
 		const int N = 12582;
+		std::vector<Quad> triangles;
+		triangles.reserve(N);
 		FILE* file;
 		fopen_s(&file, "Models/unity.tri", "r");
 		float a, b, c, d, e, f, g, h, i;
@@ -61,10 +64,12 @@ public:
 			const glm::vec3 origin = glm::vec3(a, b, c);
 			const glm::vec3 u = glm::vec3(d, e, f) - origin;
 			const glm::vec3 v = glm::vec3(g, h, i) - origin;
-			std::string triName = std::string("Triangle") + std::to_string(t);
-			AddTriangle(triName.c_str(), origin, u, v, 0);
+			triangles.push_back(Quad(TRIANGLE, origin, u, v, 0, 0));
 		}
 		fclose(file);
+
+		AddMesh("Unity", triangles);
+		AddMeshInstance("Unity", "Unity");
 	}
 
 	void UpdateScene(const float dt) override {
@@ -1,13 +1,15 @@
 #pragma once
 
+#include <vector>
+#include <glm/ext/vector_float3.hpp>
 #include "Texture.h"
 
 class Texture2DArray : public Texture2D {
 public:
-	Texture2DArray(const unsigned int num_layers = 2, GLint wrap_s = GL_CLAMP_TO_EDGE, GLint wrap_t = GL_CLAMP_TO_EDGE, GLint minFilter = GL_LINEAR, GLint magFilter = GL_LINEAR, GLint internalFormat = GL_RGBA32F, GLenum format = GL_RGBA, GLenum type = GL_FLOAT) : Texture2D(), num_layers(num_layers) {
+	Texture2DArray(const unsigned int num_layers = 2, GLint wrap_s = GL_CLAMP_TO_EDGE, GLint wrap_t = GL_CLAMP_TO_EDGE, GLint minFilter = GL_LINEAR, GLint magFilter = GL_LINEAR, GLint internalFormat = GL_RGBA32F, GLenum format = GL_RGBA, GLenum type = GL_FLOAT) : Texture2D(), num_layers(num_layers), layer_averages(num_layers, glm::vec3(0.0f)) {
 		texture_type = GL_TEXTURE_2D_ARRAY;
 	}
-	Texture2DArray(const unsigned int width, const unsigned int height, const unsigned int num_layers, GLint wrap_s = GL_CLAMP_TO_EDGE, GLint wrap_t = GL_CLAMP_TO_EDGE, GLint minFilter = GL_LINEAR, GLint magFilter = GL_LINEAR, GLint internalFormat = GL_RGBA32F, GLenum format = GL_RGBA, GLenum type = GL_FLOAT) : Texture2D(wrap_s, wrap_t, minFilter, magFilter, internalFormat, format, type), num_layers(num_layers) {
+	Texture2DArray(const unsigned int width, const unsigned int height, const unsigned int num_layers, GLint wrap_s = GL_CLAMP_TO_EDGE, GLint wrap_t = GL_CLAMP_TO_EDGE, GLint minFilter = GL_LINEAR, GLint magFilter = GL_LINEAR, GLint internalFormat = GL_RGBA32F, GLenum format = GL_RGBA, GLenum type = GL_FLOAT) : Texture2D(wrap_s, wrap_t, minFilter, magFilter, internalFormat, format, type), num_layers(num_layers), layer_averages(num_layers, glm::vec3(0.0f)) {
 		texture_type = GL_TEXTURE_2D_ARRAY;
 		this->width = width;
 		this->height = height;
@@ -27,6 +29,11 @@ public:
 			//glBindTexture(texture_type, 0);
 		}
 	}
+
+	// Mean texel colour of each layer as sampled by the shader, filled in by the loader
+	const std::vector<glm::vec3>& GetLayerAverages() const { return layer_averages; }
+	void SetLayerAverage(const unsigned int layer, const glm::vec3& average) { layer_averages[layer] = average; }
 protected:
 	unsigned num_layers;
+	std::vector<glm::vec3> layer_averages;
 };
\ No newline at end of file
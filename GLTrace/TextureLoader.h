@@ -3,6 +3,8 @@
 #include "Texture2DArray.h"
 #include "stb_image.h"
 #include <unordered_map>
+#include <algorithm>
+#include <glm/ext/vector_double3.hpp>
 #include <iostream>
 class TextureLoader {
 public:
@@ -97,6 +99,7 @@ public:
 					}
 
 					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, dataFormat, GL_UNSIGNED_BYTE, data);
+					textureArray->SetLayerAverage(i, AverageColour(data, width, height, nrComponents));
 				}
 				else {
 					std::clog << "Error loading texture at path: " << filepaths[i] << "\r\n" << std::flush;
@@ -129,6 +132,19 @@ public:
 		loadedTextureArrays.clear();
 	}
 private:
+	// Mean of the channels the shader reads as rgb, missing channels sample as zero
+	static glm::vec3 AverageColour(const unsigned char* data, const int width, const int height, const int nrComponents) {
+		const int colourComponents = std::min(nrComponents, 3);
+		const size_t numTexels = (size_t)width * height;
+		glm::dvec3 sum = glm::dvec3(0.0);
+		for (size_t texel = 0; texel < numTexels; texel++) {
+			for (int c = 0; c < colourComponents; c++) {
+				sum[c] += data[texel * nrComponents + c];
+			}
+		}
+		return numTexels > 0 ? glm::vec3(sum / (255.0 * numTexels)) : glm::vec3(0.0f);
+	}
+
 	static std::unordered_map<const char*, Texture2D*> loadedTextures;
 	static std::unordered_map<const char*, Texture2DArray*> loadedTextureArrays;
 };
\ No newline at end of file
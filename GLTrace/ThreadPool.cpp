@@ -0,0 +1,7 @@
+#include "ThreadPool.h"
+std::vector<std::thread> ThreadPool::workers;
+std::vector<ThreadPool::ParallelJob*> ThreadPool::jobQueue;
+std::mutex ThreadPool::queueMutex;
+std::condition_variable ThreadPool::queueCondition;
+std::once_flag ThreadPool::initialisedFlag;
+bool ThreadPool::stopping = false;
\ No newline at end of file
@@ -0,0 +1,137 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+// Shared pool of worker threads used by CPU side build work (BVH construction etc.)
+// ParallelFor may be called from inside a job, the calling thread always helps process its own job
+class ThreadPool {
+public:
+	// Number of threads that can work on a ParallelFor, including the calling thread
+	static unsigned int NumThreads() {
+		Initialise();
+		return workers.size() + 1;
+	}
+
+	// Calls job(i) for every i in [0, count) across the pool and returns once all calls have completed
+	// The job is type erased through a function pointer and lives on the calling thread's stack, so dispatch does not allocate
+	template <typename Job>
+	static void ParallelFor(const unsigned int count, const Job& job) {
+		if (count == 0) { return; }
+		Initialise();
+		if (count == 1 || workers.empty()) {
+			for (unsigned int i = 0; i < count; i++) {
+				job(i);
+			}
+			return;
+		}
+
+		ParallelJob parallelJob(&InvokeJob<Job>, &job, count);
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			jobQueue.push_back(&parallelJob);
+		}
+		queueCondition.notify_all();
+
+		// Calling thread helps out, then waits for any indices still in flight and for workers to release the job
+		ProcessJob(&parallelJob);
+		while (parallelJob.completed.load(std::memory_order_acquire) < count || parallelJob.users.load(std::memory_order_acquire) > 0) {
+			std::this_thread::yield();
+		}
+	}
+
+	// Splits [0, count) into contiguous chunks of at least minChunkSize and calls job(begin, end) for each chunk
+	template <typename Job>
+	static void ParallelForRange(const unsigned int count, const unsigned int minChunkSize, const Job& job) {
+		const unsigned int chunkSize = std::max(minChunkSize, (count + NumThreads() - 1) / NumThreads());
+		const unsigned int numChunks = (count + chunkSize - 1) / chunkSize;
+		ParallelFor(numChunks, [&](const unsigned int chunk) {
+			const unsigned int begin = chunk * chunkSize;
+			job(begin, std::min(count, begin + chunkSize));
+		});
+	}
+
+	static void Shutdown() {
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueCondition.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+		stopping = false;
+	}
+
+private:
+	struct ParallelJob {
+		ParallelJob(void (*invoke)(const void*, unsigned int), const void* job, const unsigned int count) : invoke(invoke), job(job), count(count), next(0), completed(0), users(0) {}
+
+		void (*invoke)(const void*, unsigned int);
+		const void* job;
+		const unsigned int count;
+		std::atomic<unsigned int> next;
+		std::atomic<unsigned int> completed;
+		std::atomic<unsigned int> users; // Workers holding a pointer to this job
+	};
+
+	template <typename Job>
+	static void InvokeJob(const void* job, const unsigned int i) {
+		(*static_cast<const Job*>(job))(i);
+	}
+
+	static void Initialise() {
+		std::call_once(initialisedFlag, []() {
+			const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+			workers.reserve(hardwareThreads - 1);
+			jobQueue.reserve(QUEUE_CAPACITY);
+			for (unsigned int i = 0; i < hardwareThreads - 1; i++) {
+				workers.push_back(std::thread(WorkerLoop));
+			}
+		});
+	}
+
+	static void ProcessJob(ParallelJob* parallelJob) {
+		while (true) {
+			const unsigned int i = parallelJob->next.fetch_add(1, std::memory_order_relaxed);
+			if (i >= parallelJob->count) { break; }
+			parallelJob->invoke(parallelJob->job, i);
+			parallelJob->completed.fetch_add(1, std::memory_order_release);
+		}
+
+		// All indices handed out, remove from queue
+		std::lock_guard<std::mutex> lock(queueMutex);
+		std::vector<ParallelJob*>::iterator it = std::find(jobQueue.begin(), jobQueue.end(), parallelJob);
+		if (it != jobQueue.end()) { jobQueue.erase(it); }
+	}
+
+	static void WorkerLoop() {
+		while (true) {
+			ParallelJob* parallelJob;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, []() { return stopping || !jobQueue.empty(); });
+				if (stopping) { return; }
+				parallelJob = jobQueue.front();
+
+				// Taken under the lock, so the job can't be removed and returned before it is counted
+				parallelJob->users.fetch_add(1, std::memory_order_relaxed);
+			}
+			ProcessJob(parallelJob);
+			parallelJob->users.fetch_sub(1, std::memory_order_release);
+		}
+	}
+
+	static constexpr unsigned int QUEUE_CAPACITY = 64; // Enough for nested jobs without growing the queue
+
+	static std::vector<std::thread> workers;
+	static std::vector<ParallelJob*> jobQueue;
+	static std::mutex queueMutex;
+	static std::condition_variable queueCondition;
+	static std::once_flag initialisedFlag;
+	static bool stopping;
+};
\ No newline at end of file